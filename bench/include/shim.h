@@ -0,0 +1,450 @@
+#ifndef BENCH_SHIM_H
+#define BENCH_SHIM_H
+
+/* Just enough of the kernel API for the ranking core (ranking.c,
+*  run_stats.c, speed_math.h) to build and run in a single-threaded userspace
+*  program. Locks are pthread mutexes, RCU grace periods end right away and
+*  allocations go to malloc(). Every <linux/...> header the core includes is
+*  a one-liner pulling this file; the rbtree comes from the kernel tree.
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <time.h>
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef unsigned long long u64;
+typedef int32_t s32;
+typedef long long s64;
+typedef uint8_t __u8;
+typedef uint16_t __u16;
+typedef uint32_t __u32;
+typedef unsigned long long __u64;
+typedef int32_t __s32;
+typedef long long __s64;
+typedef unsigned int gfp_t;
+
+#define GFP_KERNEL	0
+
+/* Compiler */
+#ifndef __always_inline
+#define __always_inline	inline __attribute__((__always_inline__))
+#endif
+#define likely(x)	__builtin_expect(!!(x), 1)
+#define unlikely(x)	__builtin_expect(!!(x), 0)
+#define __maybe_unused	__attribute__((__unused__))
+#define barrier()	__asm__ __volatile__("" : : : "memory")
+#define READ_ONCE(x)	(*(const volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val)	do { *(volatile __typeof__(x) *)&(x) = (val); } while (0)
+#define smp_wmb()	__atomic_thread_fence(__ATOMIC_RELEASE)
+#define smp_rmb()	__atomic_thread_fence(__ATOMIC_ACQUIRE)
+#define smp_mb()	__atomic_thread_fence(__ATOMIC_SEQ_CST)
+#define smp_store_release(p, v)	__atomic_store_n(p, v, __ATOMIC_RELEASE)
+#define smp_load_acquire(p)	__atomic_load_n(p, __ATOMIC_ACQUIRE)
+#define EXPORT_SYMBOL(sym)
+#define EXPORT_SYMBOL_GPL(sym)
+
+/* Kernel helpers */
+#ifndef container_of
+#define container_of(ptr, type, member) \
+	((type *)((char *)(ptr) - offsetof(type, member)))
+#endif
+#define ARRAY_SIZE(arr)	(sizeof(arr) / sizeof((arr)[0]))
+#define min(x, y)	({ __typeof__(x) _x = (x); __typeof__(y) _y = (y); _x < _y ? _x : _y; })
+#define max(x, y)	({ __typeof__(x) _x = (x); __typeof__(y) _y = (y); _x > _y ? _x : _y; })
+#define min_t(type, x, y)	({ type _x = (x); type _y = (y); _x < _y ? _x : _y; })
+#define max_t(type, x, y)	({ type _x = (x); type _y = (y); _x > _y ? _x : _y; })
+#define clamp(val, lo, hi)	min(max(val, lo), hi)
+#define DIV_ROUND_UP_ULL(x, d)	(((unsigned long long)(x) + (d) - 1) / (d))
+#define BIT(nr)		(1UL << (nr))
+#define struct_size(p, member, n)	(sizeof(*(p)) + (size_t)(n) * sizeof(*(p)->member))
+#define USEC_PER_SEC	1000000L
+#define NSEC_PER_USEC	1000L
+#define NSEC_PER_SEC	1000000000L
+
+static inline int fls(unsigned int x)
+{
+	return x ? 32 - __builtin_clz(x) : 0;
+}
+
+static inline int fls64(u64 x)
+{
+	return x ? 64 - __builtin_clzll(x) : 0;
+}
+
+static inline u32 rol32(u32 word, unsigned int shift)
+{
+	return (word << (shift & 31)) | (word >> ((-shift) & 31));
+}
+
+static inline u64 div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+static inline u64 div64_u64(u64 dividend, u64 divisor)
+{
+	return dividend / divisor;
+}
+
+/* printk: KERN_DEBUG messages are dropped, the others go to stderr */
+#define KERN_SOH	"\001"
+#define KERN_ERR	KERN_SOH "3"
+#define KERN_WARNING	KERN_SOH "4"
+#define KERN_INFO	KERN_SOH "6"
+#define KERN_DEBUG	KERN_SOH "7"
+
+static inline __attribute__((format(printf, 1, 2))) int printk(const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	if (fmt[0] == KERN_SOH[0]) {
+		if (fmt[1] == '7')
+			return 0;
+		fmt += 2;
+	}
+	va_start(args, fmt);
+	ret = vfprintf(stderr, fmt, args);
+	va_end(args);
+	return ret;
+}
+
+static inline __attribute__((format(printf, 3, 4))) int scnprintf(char *buf, size_t size, const char *fmt, ...)
+{
+	va_list args;
+	int ret;
+
+	if (size == 0)
+		return 0;
+	va_start(args, fmt);
+	ret = vsnprintf(buf, size, fmt, args);
+	va_end(args);
+	return ret < (int)size ? ret : (int)size - 1;
+}
+
+static inline ssize_t strscpy(char *dest, const char *src, size_t count)
+{
+	size_t len = strnlen(src, count);
+
+	if (count == 0)
+		return -E2BIG;
+	if (len == count) {
+		memcpy(dest, src, count - 1);
+		dest[count - 1] = '\0';
+		return -E2BIG;
+	}
+	memcpy(dest, src, len + 1);
+	return len;
+}
+
+/* Time */
+static inline u64 bench_clock_ns(clockid_t clock)
+{
+	struct timespec ts;
+	clock_gettime(clock, &ts);
+	return (u64)ts.tv_sec * NSEC_PER_SEC + ts.tv_nsec;
+}
+
+#define ktime_get_ns()		bench_clock_ns(CLOCK_MONOTONIC)
+#define ktime_get_real_ns()	bench_clock_ns(CLOCK_REALTIME)
+
+/* Memory */
+#define kmalloc(size, gfp)		malloc(size)
+#define kzalloc(size, gfp)		calloc(1, size)
+#define kmalloc_array(n, size, gfp)	malloc((n) * (size))
+#define kvmalloc_array(n, size, gfp)	malloc((n) * (size))
+#define kvzalloc(size, gfp)		calloc(1, size)
+#define vmalloc(size)			malloc(size)
+#define vzalloc(size)			calloc(1, size)
+#define kfree(p)			free(p)
+#define kvfree(p)			free(p)
+#define vfree(p)			free(p)
+
+struct kmem_cache {
+	size_t size;
+};
+
+static inline struct kmem_cache *kmem_cache_create(const char *name, size_t size, size_t align,
+						   unsigned long flags, void (*ctor)(void *))
+{
+	struct kmem_cache *c = malloc(sizeof(*c));
+	if (c)
+		c->size = size;
+	return c;
+}
+
+#define kmem_cache_alloc(c, gfp)	malloc((c)->size)
+#define kmem_cache_free(c, p)		free(p)
+#define kmem_cache_destroy(c)		free(c)
+
+typedef struct mempool {
+	struct kmem_cache *cache;
+} mempool_t;
+
+static inline mempool_t *mempool_create_slab_pool(int min_nr, struct kmem_cache *cache)
+{
+	mempool_t *pool = malloc(sizeof(*pool));
+	if (pool)
+		pool->cache = cache;
+	return pool;
+}
+
+static inline void *mempool_alloc(mempool_t *pool, gfp_t gfp)
+{
+	void *p = malloc(pool->cache->size);
+	if (!p)
+		abort();	// the kernel would wait for the reserve
+	return p;
+}
+
+#define mempool_free(p, pool)	free(p)
+#define mempool_destroy(pool)	free(pool)
+
+/* Locking: the benchmark is single threaded, seqcount readers never retry */
+struct mutex {
+	pthread_mutex_t lock;
+};
+
+#define mutex_init(m)	pthread_mutex_init(&(m)->lock, NULL)
+#define mutex_lock(m)	pthread_mutex_lock(&(m)->lock)
+#define mutex_unlock(m)	pthread_mutex_unlock(&(m)->lock)
+
+typedef struct {
+	unsigned int sequence;
+} seqcount_mutex_t;
+
+#define seqcount_mutex_init(s, lock)	((s)->sequence = 0)
+#define write_seqcount_begin(s)		do { (s)->sequence++; smp_wmb(); } while (0)
+#define write_seqcount_end(s)		do { smp_wmb(); (s)->sequence++; } while (0)
+#define read_seqcount_begin(s)		({ unsigned int _seq = READ_ONCE((s)->sequence); smp_rmb(); _seq; })
+#define read_seqcount_retry(s, start)	({ smp_rmb(); READ_ONCE((s)->sequence) != (start); })
+
+typedef struct {
+	int unused;
+} wait_queue_head_t;
+
+#define init_waitqueue_head(wq)		((wq)->unused = 0)
+#define wake_up_interruptible(wq)	do { } while (0)
+
+/* RCU: no concurrent readers, so a grace period is over right away */
+struct rcu_head {
+	struct rcu_head *next;
+	void (*func)(struct rcu_head *head);
+};
+
+#define rcu_read_lock()		do { } while (0)
+#define rcu_read_unlock()	do { } while (0)
+#define rcu_barrier()		do { } while (0)
+#define rcu_dereference(p)	READ_ONCE(p)
+#define call_rcu(head, f)	(f)(head)
+#define rb_link_node_rcu	rb_link_node
+
+/* Lists */
+struct list_head {
+	struct list_head *next, *prev;
+};
+
+struct hlist_head {
+	struct hlist_node *first;
+};
+
+struct hlist_node {
+	struct hlist_node *next, **pprev;
+};
+
+#define LIST_HEAD_INIT(name)	{ &(name), &(name) }
+#define LIST_HEAD(name)		struct list_head name = LIST_HEAD_INIT(name)
+
+static inline void INIT_LIST_HEAD(struct list_head *list)
+{
+	list->next = list->prev = list;
+}
+
+static inline void __list_add(struct list_head *new, struct list_head *prev, struct list_head *next)
+{
+	next->prev = new;
+	new->next = next;
+	new->prev = prev;
+	WRITE_ONCE(prev->next, new);
+}
+
+static inline void list_add(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head, head->next);
+}
+
+static inline void list_add_tail(struct list_head *new, struct list_head *head)
+{
+	__list_add(new, head->prev, head);
+}
+
+static inline void list_del(struct list_head *entry)
+{
+	entry->next->prev = entry->prev;
+	WRITE_ONCE(entry->prev->next, entry->next);
+}
+
+static inline int list_empty(const struct list_head *head)
+{
+	return READ_ONCE(head->next) == head;
+}
+
+#define list_add_rcu		list_add
+#define list_add_tail_rcu	list_add_tail
+#define list_del_rcu		list_del
+
+#define list_entry(ptr, type, member)	container_of(ptr, type, member)
+#define list_first_entry(ptr, type, member)	list_entry((ptr)->next, type, member)
+#define list_next_entry(pos, member)	list_entry((pos)->member.next, __typeof__(*(pos)), member)
+#define list_first_or_null_rcu(ptr, type, member) \
+	(list_empty(ptr) ? NULL : list_first_entry(ptr, type, member))
+#define list_next_or_null_rcu(head, ptr, type, member) \
+	((ptr)->next == (head) ? NULL : list_entry((ptr)->next, type, member))
+#define list_for_each_entry(pos, head, member) \
+	for (pos = list_first_entry(head, __typeof__(*pos), member); \
+	     &pos->member != (head); \
+	     pos = list_next_entry(pos, member))
+#define list_for_each_entry_rcu(pos, head, member, cond...) \
+	list_for_each_entry(pos, head, member)
+#define list_for_each_entry_safe(pos, n, head, member) \
+	for (pos = list_first_entry(head, __typeof__(*pos), member), \
+	     n = list_next_entry(pos, member); \
+	     &pos->member != (head); \
+	     pos = n, n = list_next_entry(n, member))
+
+static inline void hlist_add_head(struct hlist_node *n, struct hlist_head *h)
+{
+	struct hlist_node *first = h->first;
+	n->next = first;
+	if (first)
+		first->pprev = &n->next;
+	WRITE_ONCE(h->first, n);
+	n->pprev = &h->first;
+}
+
+static inline void hlist_del(struct hlist_node *n)
+{
+	struct hlist_node *next = n->next;
+	WRITE_ONCE(*n->pprev, next);
+	if (next)
+		next->pprev = n->pprev;
+}
+
+static inline void hlist_replace_rcu(struct hlist_node *old, struct hlist_node *new)
+{
+	struct hlist_node *next = old->next;
+	new->next = next;
+	new->pprev = old->pprev;
+	WRITE_ONCE(*new->pprev, new);
+	if (next)
+		next->pprev = &new->next;
+}
+
+#define hlist_entry_safe(ptr, type, member) \
+	({ __typeof__(ptr) ____ptr = (ptr); \
+	   ____ptr ? container_of(____ptr, type, member) : NULL; })
+#define hlist_for_each_entry(pos, head, member) \
+	for (pos = hlist_entry_safe((head)->first, __typeof__(*(pos)), member); \
+	     pos; \
+	     pos = hlist_entry_safe((pos)->member.next, __typeof__(*(pos)), member))
+
+/* Hashtables */
+#define GOLDEN_RATIO_32	0x61C88647
+
+static inline u32 hash_32(u32 val, unsigned int bits)
+{
+	return (val * GOLDEN_RATIO_32) >> (32 - bits);
+}
+
+#define DECLARE_HASHTABLE(name, bits)	struct hlist_head name[1 << (bits)]
+#define HASH_SIZE(name)		(ARRAY_SIZE(name))
+#define HASH_BITS(name)		(__builtin_ctz(HASH_SIZE(name)))
+#define hash_min(val, bits)	hash_32(val, bits)
+#define hash_init(table)	memset(table, 0, sizeof(table))
+#define hash_add_rcu(table, node, key) \
+	hlist_add_head(node, &table[hash_min(key, HASH_BITS(table))])
+#define hash_del_rcu(node)	hlist_del(node)
+#define hash_for_each_possible(name, obj, member, key) \
+	hlist_for_each_entry(obj, &name[hash_min(key, HASH_BITS(name))], member)
+#define hash_for_each_possible_rcu(name, obj, member, key, cond...) \
+	hash_for_each_possible(name, obj, member, key)
+
+/* jhash, as in the kernel */
+#define JHASH_INITVAL	0xdeadbeef
+
+#define __jhash_mix(a, b, c) \
+{ \
+	a -= c;  a ^= rol32(c, 4);  c += b; \
+	b -= a;  b ^= rol32(a, 6);  a += c; \
+	c -= b;  c ^= rol32(b, 8);  b += a; \
+	a -= c;  a ^= rol32(c, 16); c += b; \
+	b -= a;  b ^= rol32(a, 19); a += c; \
+	c -= b;  c ^= rol32(b, 4);  b += a; \
+}
+
+#define __jhash_final(a, b, c) \
+{ \
+	c ^= b; c -= rol32(b, 14); \
+	a ^= c; a -= rol32(c, 11); \
+	b ^= a; b -= rol32(a, 25); \
+	c ^= b; c -= rol32(b, 16); \
+	a ^= c; a -= rol32(c, 4);  \
+	b ^= a; b -= rol32(a, 14); \
+	c ^= b; c -= rol32(b, 24); \
+}
+
+static inline u32 jhash(const void *key, u32 length, u32 initval)
+{
+	const u8 *k = key;
+	u32 a, b, c, w[3];
+
+	a = b = c = JHASH_INITVAL + length + initval;
+	while (length > 12) {
+		memcpy(w, k, sizeof(w));
+		a += w[0];
+		b += w[1];
+		c += w[2];
+		__jhash_mix(a, b, c);
+		length -= 12;
+		k += 12;
+	}
+	switch (length) {
+	case 12: c += (u32)k[11] << 24;	/* fall through */
+	case 11: c += (u32)k[10] << 16;	/* fall through */
+	case 10: c += (u32)k[9] << 8;	/* fall through */
+	case 9:  c += k[8];		/* fall through */
+	case 8:  b += (u32)k[7] << 24;	/* fall through */
+	case 7:  b += (u32)k[6] << 16;	/* fall through */
+	case 6:  b += (u32)k[5] << 8;	/* fall through */
+	case 5:  b += k[4];		/* fall through */
+	case 4:  a += (u32)k[3] << 24;	/* fall through */
+	case 3:  a += (u32)k[2] << 16;	/* fall through */
+	case 2:  a += (u32)k[1] << 8;	/* fall through */
+	case 1:  a += k[0];
+		 __jhash_final(a, b, c);
+	case 0:
+		break;
+	}
+	return c;
+}
+
+/* debugfs and tracepoints compile to nothing */
+struct dentry;
+
+#define TP_PROTO(args...)	args
+#define TRACE_EVENT(name, proto, args, tstruct, assign, print) \
+	static inline void trace_##name(proto) {}
+
+#endif /* BENCH_SHIM_H */
@@ -0,0 +1 @@
+/* The tracepoints are empty inlines, nothing to define */
@@ -0,0 +1,216 @@
+#include <getopt.h>
+
+#include <linux/types.h>
+
+#include "ranking.h"
+#include "speed_math.h"
+
+/* Drives the ranking core through the run pipeline the module uses (PIR
+*  timestamps -> speed_math.h -> ranking_store_time()) and reports the cost
+*  of each operation:
+*    ./ranking_bench [-n runs] [-u riders] [-p sensors] [-H history_len] [-s seed]
+*/
+
+#define SENSORS_DIST	100	// decimeters, the module default
+
+struct workload {
+	const char *name;
+	unsigned int riders;	// distinct names, 0 for the -u value
+	unsigned int time_span;	// run times drawn in [4 s, 4 s + span[
+};
+
+static const struct workload workloads[] = {
+	{ "uniform",	0,	4000000 },	// many riders, few repeats
+	{ "repeat",	64,	4000000 },	// a club riding all day
+	{ "ties",	0,	16 },		// coarse clock, most times equal
+};
+
+static u64 rng_state;
+static unsigned int sensors = 2;
+
+static u32 rng_next(void)
+{
+	// xorshift64*
+	rng_state ^= rng_state >> 12;
+	rng_state ^= rng_state << 25;
+	rng_state ^= rng_state >> 27;
+	return (rng_state * 0x2545F4914F6CDD1DULL) >> 32;
+}
+
+static double per_op(u64 ns, unsigned long ops)
+{
+	return ops ? (double)ns / ops : 0;
+}
+
+/* Leaderboard order must hold whatever the workload: times never decrease
+*  and the positions match the ex-aequo rule
+*/
+static int check_order(struct ranking *r)
+{
+	struct ranking_entry e[256];
+	unsigned int offset = 0, total, n, i;
+	unsigned int prev_time = 0, prev_pos = 0, seen = 0;
+
+	do {
+		n = ranking_get_page(r, e, offset, ARRAY_SIZE(e), &total);
+		for (i = 0; i < n; i++, seen++) {
+			if (e[i].best_time_us < prev_time ||
+			    (e[i].best_time_us == prev_time && e[i].pos != prev_pos) ||
+			    (e[i].best_time_us != prev_time && e[i].pos != offset + i + 1)) {
+				fprintf(stderr, "order broken at %u: %s %u pos %u\n",
+					offset + i, e[i].name, e[i].best_time_us, e[i].pos);
+				return -1;
+			}
+			prev_time = e[i].best_time_us;
+			prev_pos = e[i].pos;
+		}
+		offset += n;
+	} while (n);
+	if (seen != total) {
+		fprintf(stderr, "walked %u users out of %u\n", seen, total);
+		return -1;
+	}
+	return 0;
+}
+
+static int run_workload(const struct workload *w, unsigned long runs, unsigned int riders,
+			unsigned int history_len)
+{
+	struct ranking *r;
+	char name[RANKING_NAME_LEN];
+	struct ranking_entry e;
+	unsigned long inserts = 0, updates = 0, i;
+	u64 insert_ns = 0, update_ns = 0, t0, t1, ts[PIR_MAX_SENSORS];
+	u32 splits[RANKING_SPLITS_MAX];
+	u64 delta_us;
+	unsigned int vel, total, before, nsplits, k;
+	size_t size, buf_size = 1 << 20;
+	char *buf;
+	void *snapshot;
+	int ret = 0;
+
+	if (w->riders)
+		riders = w->riders;
+	r = ranking_create("", 0, 64, history_len);
+	buf = malloc(buf_size);
+	if (!r || !buf) {
+		fprintf(stderr, "out of memory\n");
+		return -1;
+	}
+
+	// Store: one timestamp per PIR for each run, as the sampling thread sees it
+	ts[sensors - 1] = 0;
+	for (i = 0; i < runs; i++) {
+		snprintf(name, sizeof(name), "rider%u", rng_next() % riders);
+		ts[0] = ts[sensors - 1];
+		for (k = 1; k < sensors; k++)
+			ts[k] = ts[k - 1] + (4000000 + rng_next() % w->time_span) / (sensors - 1) * 
+					    NSEC_PER_USEC;
+		delta_us = speed_run_time_us(ts[0], ts[sensors - 1]);
+		if (!speed_run_time_valid(delta_us))
+			continue;
+		vel = speed_velocity(SENSORS_DIST * (sensors - 1), delta_us);
+		nsplits = speed_splits_us(ts, sensors, splits);
+
+		before = r->count;
+		t0 = ktime_get_ns();
+		ret = ranking_store_time(r, name, delta_us, vel, splits, nsplits);
+		t1 = ktime_get_ns();
+		if (ret) {
+			fprintf(stderr, "ranking_store_time: %d\n", ret);
+			goto out;
+		}
+		if (r->count != before) {
+			insert_ns += t1 - t0;
+			inserts++;
+		} else {
+			update_ns += t1 - t0;
+			updates++;
+		}
+	}
+
+	printf("%-8s users %7u  insert %8.1f ns/op  update %8.1f ns/op\n",
+	       w->name, r->count, per_op(insert_ns, inserts), per_op(update_ns, updates));
+
+	// Formatting, as the leaderboard attribute does
+	t0 = ktime_get_ns();
+	size = ranking_print(r, buf, buf_size);
+	t1 = ktime_get_ns();
+	printf("         print %zu bytes in %.1f us (%.1f MB/s)\n",
+	       size, (t1 - t0) / 1e3, size * 1e3 / (t1 - t0 ? t1 - t0 : 1));
+
+	// Queries, as the ioctls do
+	t0 = ktime_get_ns();
+	for (i = 0; i < 100000; i++) {
+		snprintf(name, sizeof(name), "rider%u", rng_next() % riders);
+		ranking_get_user(r, name, &e, &total);
+	}
+	t1 = ktime_get_ns();
+	printf("         get_user %.1f ns/op", per_op(t1 - t0, 100000));
+	t0 = ktime_get_ns();
+	for (i = 0; i < 100000; i++)
+		ranking_get_page(r, &e, rng_next() % (r->count + 1), 1, &total);
+	t1 = ktime_get_ns();
+	printf("  get_page %.1f ns/op\n", per_op(t1 - t0, 100000));
+
+	// Snapshot
+	t0 = ktime_get_ns();
+	snapshot = ranking_export(r, &size);
+	t1 = ktime_get_ns();
+	if (snapshot)
+		printf("         export %zu bytes in %.1f us\n", size, (t1 - t0) / 1e3);
+	vfree(snapshot);
+
+	// Each user is one cache object, plus its hashtable and tree links
+	printf("         memory %zu bytes/user, %zu bytes of fixed state\n",
+	       struct_size((struct ranking_user *)NULL, history, r->history_len), sizeof(*r));
+
+	ret = check_order(r);
+out:
+	free(buf);
+	ranking_destroy(r);
+	return ret;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned long runs = 1000000;
+	unsigned int riders = 100000, history_len = 8;
+	unsigned int i;
+	int opt;
+
+	rng_state = 0x5eed;
+	while ((opt = getopt(argc, argv, "n:u:p:H:s:")) != -1) {
+		switch (opt) {
+		case 'n':
+			runs = strtoul(optarg, NULL, 0);
+			break;
+		case 'u':
+			riders = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			sensors = strtoul(optarg, NULL, 0);
+			break;
+		case 'H':
+			history_len = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			rng_state = strtoull(optarg, NULL, 0) | 1;
+			break;
+		default:
+			fprintf(stderr, "usage: %s [-n runs] [-u riders] [-p sensors] "
+				"[-H history_len] [-s seed]\n", argv[0]);
+			return 2;
+		}
+	}
+	if (!riders)
+		riders = 1;
+	sensors = clamp(sensors, 2U, (unsigned int)PIR_MAX_SENSORS);
+
+	printf("%lu runs, %u riders, %u sensors, history %u\n", runs, riders, sensors,
+	       history_len);
+	for (i = 0; i < ARRAY_SIZE(workloads); i++)
+		if (run_workload(&workloads[i], runs, riders, history_len))
+			return 1;
+	return 0;
+}
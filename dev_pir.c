@@ -1,28 +1,105 @@
+#include <linux/debugfs.h>
 #include <linux/delay.h>
+#include <linux/err.h>
 #include <linux/gpio.h>
+#include <linux/hrtimer.h>
 #include <linux/interrupt.h>
+#include <linux/kfifo.h>
+#include <linux/kthread.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
 #include <linux/rtc.h>
 #include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 
 #include "dev_pir.h"
+#include "speed_uapi.h"
 
-#define PIN_PIR1	15 	// PIR1
-#define PIN_PIR2	18	// PIR2
+#define CREATE_TRACE_POINTS
+#include "speed_trace.h"
 
-struct timespec t1, t2;
-static char last_irq_time_pir1[64];
-static char last_irq_time_pir2[64];
-struct completion sample_available;
+#define PIR_SAMPLES	16	// completed runs waiting for the sampling thread
+#define PIR_INJECT_MAX	4096	// bytes of injected edges parsed per write()
+#define PIR_TRACE_BATCH	256	// trace records copied per read() or write()
 
-unsigned int irq_pir1, irq_pir2;
+/* One context per sensor, handed to its IRQ handlers */
+struct pir_sensor {
+	struct pir_array *pa;
+	unsigned int index;		// 1-based, in track order
+	unsigned int pin;
+	unsigned int irq;
+	char last_irq_time[64];
+	char name[16];			// device and IRQ name, "pirN" then "pirN_M"
+	char label[8];			// GPIO label, "PIR N"
+	struct miscdevice device;
 
-static struct gpio pir_gpios[] = {
-	{ PIN_PIR1, GPIOF_IN, "PIR 1" },
-	{ PIN_PIR2, GPIOF_IN, "PIR 2" },
+	/* Edge filter, see struct pir_filter. The pulse width is checked by
+	*  pulse_timer, unless the controller debounces or there is no pin.
+	*/
+	struct pir_filter filter;
+	bool hw_debounce;
+	u64 debounce_ns;		// how late the controller reports an edge
+	u64 dead_time_ns;
+	u64 min_pulse_ns;		// 0 when the timer is not used
+	raw_spinlock_t filter_lock;
+	u64 last_edge;			// last edge let through, 0 if none yet
+	bool pulse_pending;
+	u64 pulse_start;		// rising edge pulse_timer is checking
+	struct hrtimer pulse_timer;
+	unsigned long dead_time_drops, short_pulse_drops;
 };
 
-static struct miscdevice pir1_device, pir2_device;
+/* The PIRs of one speed trap, with everything their edges go through. Traps
+*  share nothing, so their IRQs and sampling threads never contend.
+*/
+struct pir_array {
+	unsigned int trap;		// owner, for the tracepoints
+	bool sim;			// edges come from debugfs rather than GPIO IRQs
+	unsigned int count;
+	struct pir_sensor sensors[PIR_MAX_SENSORS];
+
+	struct dentry *inject_file, *replay_file, *record_file, *filter_file;
+	struct dentry *replay_realtime_file;
+	bool replay_realtime;		// replay with the original timing
+	bool closing;			// lets the debugfs files stop waiting on unload
+
+	/* Run state: each pir_arm() allows one more run. A run starts on a
+	*  PIR1 edge and takes the next edge of each following sensor in turn;
+	*  the edge of the last one queues it for the sampling thread and lets
+	*  the next run start right away.
+	*/
+	spinlock_t lock;
+	unsigned int credits;
+	unsigned int replay_credit;	// replayed run holding a credit, 0 if none
+	unsigned int run_next;		// sensor expected next, 0 if no run in progress
+	u64 run_ts[PIR_MAX_SENSORS];
+	DECLARE_KFIFO(samples, struct pir_sample, PIR_SAMPLES);
+	wait_queue_head_t sample_wq;
+
+	/* Every edge goes to a ring shared read-only with userspace (see
+	*  speed_uapi.h), the ones dropped by the filter flagged as rejected.
+	*  The IRQ handlers and pulse timers may run on different CPUs, so the
+	*  lock only makes them a single producer; readers never take it.
+	*/
+	struct pir_ring_header *ring;
+	struct pir_event *ring_events;
+	size_t ring_bytes;
+	u64 ring_head;
+	raw_spinlock_t ring_lock;
+	wait_queue_head_t ring_wq;	// trace recorders and replayers
+};
+
+static struct file_operations pir_fops;
+
+/* misc_open() leaves the miscdevice of the sensor in private_data */
+static struct pir_sensor *pir_from_file(struct file *file) 
+{
+	return container_of(file->private_data, struct pir_sensor, device);
+}
 
 static int pir_open(struct inode *inode, struct file *file)
 {
@@ -34,143 +111,778 @@ static int pir_close(struct inode *inode, struct file *file)
 	return 0;
 }
 
-static ssize_t pir_read(struct file *file, char __user *p, size_t len, loff_t *ppos)
+static int pir_mmap(struct file *file, struct vm_area_struct *vma)
 {
-	char buf[128];
-	int cnt;
-	if (*ppos != 0)
-		return 0;
-	cnt = snprintf(buf, 127, "PIR1: \t%s\nPIR2: \t%s\n", 
-			strlen(last_irq_time_pir1) ? last_irq_time_pir1 : "never", 
-			strlen(last_irq_time_pir2) ? last_irq_time_pir2 : "never");
-	buf[cnt] = '\0';
-	if (copy_to_user(p, buf, cnt)) {
-		printk(KERN_ERR "Invalid address passed as argument to pir_read()\n");
-		return -EFAULT;
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	vma->vm_flags &= ~VM_MAYWRITE;
+	return remap_vmalloc_range(vma, pir_from_file(file)->pa->ring, vma->vm_pgoff);
+}
+
+static void pir_ring_push(struct pir_array *pa, unsigned int sensor, u64 timestamp, 
+			  u32 flags) 
+{
+	struct pir_event *ev;
+	unsigned long irq_flags;
+	u64 n;
+
+	raw_spin_lock_irqsave(&pa->ring_lock, irq_flags);
+	n = pa->ring_head++;
+	ev = &pa->ring_events[n & (PIR_RING_SIZE - 1)];
+	WRITE_ONCE(ev->seq, 0);		// invalidate the slot while rewriting it
+	smp_wmb();
+	ev->timestamp_ns = timestamp;
+	ev->sensor = sensor;
+	ev->flags = flags;
+	smp_wmb();
+	WRITE_ONCE(ev->seq, n + 1);
+	smp_store_release(&pa->ring->head, n + 1);
+	raw_spin_unlock_irqrestore(&pa->ring_lock, irq_flags);
+	wake_up_interruptible(&pa->ring_wq);
+}
+
+static int pir_ring_create(struct pir_array *pa) 
+{
+	size_t data_offset = PAGE_ALIGN(sizeof(struct pir_ring_header));
+
+	pa->ring_bytes = PAGE_ALIGN(data_offset + PIR_RING_SIZE * sizeof(struct pir_event));
+	pa->ring = vmalloc_user(pa->ring_bytes);	// zeroed
+	if (!pa->ring)
+		return -ENOMEM;
+	pa->ring->version = PIR_RING_VERSION;
+	pa->ring->size = PIR_RING_SIZE;
+	pa->ring->data_offset = data_offset;
+	pa->ring_events = (struct pir_event *)((char *)pa->ring + data_offset);
+	pa->ring_head = 0;
+	return 0;
+}
+
+/* Runs are only timed while armed; the IRQs stay enabled all the time so
+*  that every edge is recorded.
+*/
+void pir_arm(struct pir_array *pa) 
+{
+	unsigned long flags;
+	spin_lock_irqsave(&pa->lock, flags);
+	++pa->credits;
+	spin_unlock_irqrestore(&pa->lock, flags);
+}
+
+/* Gives replayed run number run the credit it had when recorded, unless a
+*  rider already did. Returns true if it did.
+*/
+static bool pir_arm_if_idle(struct pir_array *pa, unsigned int run) 
+{
+	unsigned long flags;
+	bool armed = false;
+
+	spin_lock_irqsave(&pa->lock, flags);
+	if (pa->credits == 0 && pa->run_next == 0) {
+		++pa->credits;
+		pa->replay_credit = run;
+		armed = true;
+	}
+	spin_unlock_irqrestore(&pa->lock, flags);
+	return armed;
+}
+
+/* The sampling thread of the trap is the only consumer of samples */
+static bool pir_sample_pending(struct pir_array *pa) 
+{
+	return !kfifo_is_empty(&pa->samples);
+}
+
+/* Sleeps until a sample is pending or the calling kthread should stop */
+void pir_wait_sample(struct pir_array *pa) 
+{
+	wait_event_interruptible(pa->sample_wq, 
+			pir_sample_pending(pa) || kthread_should_stop());
+}
+
+bool pir_get_sample(struct pir_array *pa, struct pir_sample *s) 
+{
+	return kfifo_get(&pa->samples, s);
+}
+
+/* Feeds an edge to the run state, returns true if it timed a run */
+static bool pir_edge(struct pir_array *pa, unsigned int sensor, u64 timestamp) 
+{
+	struct pir_sample s;
+	unsigned long flags;
+	bool accepted = false, done = false;
+
+	spin_lock_irqsave(&pa->lock, flags);
+	if (sensor == 1 && pa->run_next == 0 && pa->credits > 0) {
+		pa->run_ts[0] = timestamp;
+		pa->run_next = 2;
+		accepted = true;
+	} else if (pa->run_next != 0 && sensor == pa->run_next) {
+		pa->run_ts[sensor - 1] = timestamp;
+		accepted = true;
+		if (sensor < pa->count) {
+			++pa->run_next;
+		} else {
+			s.count = pa->count;
+			memcpy(s.ts, pa->run_ts, pa->count * sizeof(*pa->run_ts));
+			// A replay only arms when idle, so its credit is the first one
+			s.replay_run = pa->replay_credit;
+			s.queued = ktime_get_ns();
+			if (kfifo_put(&pa->samples, s)) {
+				--pa->credits;
+				pa->replay_credit = 0;
+				done = true;
+			} else {
+				printk(KERN_WARNING "PIR samples queue full, run dropped\n");
+				accepted = false;
+			}
+			pa->run_next = 0;
+		}
 	}
-	*ppos += cnt;
-	return cnt;
+	spin_unlock_irqrestore(&pa->lock, flags);
+
+	if (done)
+		wake_up(&pa->sample_wq);
+	return accepted;
+}
+
+static ssize_t pir_read(struct file *file, char __user *p, size_t len, loff_t *ppos)
+{
+	struct pir_array *pa = pir_from_file(file)->pa;
+	char buf[PIR_MAX_SENSORS * 80];
+	struct pir_sensor *pir;
+	size_t cnt = 0;
+
+	for (pir = pa->sensors; pir < pa->sensors + pa->count; ++pir)
+		cnt += scnprintf(buf + cnt, sizeof(buf) - cnt, "PIR%u: \t%s\n", pir->index, 
+				 strlen(pir->last_irq_time) ? pir->last_irq_time : "never");
+	return simple_read_from_buffer(p, len, ppos, buf, cnt);
 }
 
-void save_irq_time(char* buf, time64_t tv_sec, long tv_nsec) 
+void save_irq_time(char* buf) 
 {
 	struct rtc_time tm;
-	unsigned long local_time = (u32)(2 * 3600 + tv_sec - (sys_tz.tz_minuteswest * 60));
-	rtc_time_to_tm(local_time, &tm);
+	time64_t local_time = 2 * 3600 + ktime_get_real_seconds() - (sys_tz.tz_minuteswest * 60);
+	rtc_time64_to_tm(local_time, &tm);
 	
 	snprintf(buf, 63, "%04d-%02d-%02d %02d:%02d:%02d", tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday,
 		 tm.tm_hour, tm.tm_min, tm.tm_sec);
 	buf[63] = '\0';
 }
 
-static irq_handler_t pir_irq_handler(unsigned int irq, void *dev, struct pt_regs *regs) 
+/* Feeds an edge let through the filter to the run state and the ring,
+*  returns true if it timed a run. Safe in hard IRQ context.
+*/
+static bool pir_take_edge(struct pir_array *pa, unsigned int sensor, u64 timestamp) 
+{
+	bool accepted = pir_edge(pa, sensor, timestamp);
+	pir_ring_push(pa, sensor, timestamp, accepted ? PIR_EVENT_ACCEPTED : 0);
+	return accepted;
+}
+
+/* An edge dropped by the filter still goes to the ring, flagged */
+static void pir_reject(struct pir_sensor *pir, u64 timestamp, 
+		       enum pir_reject_reason reason) 
+{
+	trace_speed_pir_reject(pir->pa->trap, pir->index, timestamp, reason);
+	pir_ring_push(pir->pa, pir->index, timestamp, PIR_EVENT_REJECTED);
+}
+
+/* Everything after the timestamp, for the pulse timers and injection */
+static void pir_handle_edge(struct pir_array *pa, unsigned int sensor, u64 timestamp) 
+{
+	if (pir_take_edge(pa, sensor, timestamp))
+		save_irq_time(pa->sensors[sensor - 1].last_irq_time);
+}
+
+/* First stage of the filter, for every source of edges: drops an edge that
+*  comes within the dead time of the last one let through. Without a pulse
+*  check pending, an edge passing it is let through.
+*/
+static bool pir_dead_time_pass(struct pir_sensor *pir, u64 timestamp) 
+{
+	unsigned long flags;
+	bool pass;
+
+	raw_spin_lock_irqsave(&pir->filter_lock, flags);
+	pass = !pir->last_edge || timestamp < pir->last_edge || 
+	       timestamp - pir->last_edge >= pir->dead_time_ns;
+	if (!pass)
+		++pir->dead_time_drops;
+	else if (!pir->min_pulse_ns)
+		pir->last_edge = timestamp;
+	raw_spin_unlock_irqrestore(&pir->filter_lock, flags);
+
+	if (!pass)
+		pir_reject(pir, timestamp, PIR_REJECT_DEAD_TIME);
+	return pass;
+}
+
+/* A rising edge starts the pulse check, replacing a pending one: the output
+*  fell in between, so that pulse was too short.
+*/
+static void pir_pulse_start(struct pir_sensor *pir, u64 timestamp) 
+{
+	unsigned long flags;
+	u64 dropped = 0;
+
+	raw_spin_lock_irqsave(&pir->filter_lock, flags);
+	if (pir->pulse_pending) {
+		dropped = pir->pulse_start;
+		++pir->short_pulse_drops;
+	}
+	pir->pulse_pending = true;
+	pir->pulse_start = timestamp;
+	hrtimer_start(&pir->pulse_timer, ns_to_ktime(pir->min_pulse_ns), HRTIMER_MODE_REL_SOFT);
+	raw_spin_unlock_irqrestore(&pir->filter_lock, flags);
+
+	if (dropped)
+		pir_reject(pir, dropped, PIR_REJECT_SHORT_PULSE);
+}
+
+/* Softirq: the edge is let through, with the time it rose, if the output
+*  is still high
+*/
+static enum hrtimer_restart pir_pulse_timer(struct hrtimer *timer) 
+{
+	struct pir_sensor *pir = container_of(timer, struct pir_sensor, pulse_timer);
+	bool high = gpio_get_value(pir->pin);
+	unsigned long flags;
+	u64 timestamp;
+
+	raw_spin_lock_irqsave(&pir->filter_lock, flags);
+	timestamp = pir->pulse_start;
+	// A newer edge may have restarted the timer while it was expiring
+	if (!pir->pulse_pending || ktime_get_ns() - timestamp < pir->min_pulse_ns) {
+		raw_spin_unlock_irqrestore(&pir->filter_lock, flags);
+		return HRTIMER_NORESTART;
+	}
+	pir->pulse_pending = false;
+	if (high)
+		pir->last_edge = timestamp;
+	else
+		++pir->short_pulse_drops;
+	raw_spin_unlock_irqrestore(&pir->filter_lock, flags);
+
+	if (high) {
+		trace_speed_pir_edge(pir->pa->trap, pir->index, timestamp);
+		pir_handle_edge(pir->pa, pir->index, timestamp);
+	} else {
+		pir_reject(pir, timestamp, PIR_REJECT_SHORT_PULSE);
+	}
+	return HRTIMER_NORESTART;
+}
+
+/* Hard IRQ handler: takes the timestamp as early as possible, in the context
+*  of its sensor, and filters the edge right away so that a bounce costs
+*  nothing more. The run state and the ring only take a few stores under
+*  their locks, so the edge goes through them here too and nothing is handed
+*  to the thread but the wake-up.
+*  A debounced edge is only reported once the line stayed high for the
+*  debounce period, so it is dated back to when it rose.
+*/
+static irqreturn_t pir_irq_handler(int irq, void *dev) 
+{
+	struct pir_sensor *pir = dev;
+	u64 now = ktime_get_ns() - pir->debounce_ns;
+
+	if (!pir_dead_time_pass(pir, now))
+		return IRQ_HANDLED;
+	if (pir->min_pulse_ns) {
+		pir_pulse_start(pir, now);
+		return IRQ_HANDLED;
+	}
+	trace_speed_pir_edge(pir->pa->trap, pir->index, now);
+	return pir_take_edge(pir->pa, pir->index, now) ? IRQ_WAKE_THREAD : IRQ_HANDLED;
+}
+
+/* Formats the wall-clock time of the last edge that timed a run. Edges that
+*  come before it runs share one wake-up, and so one string, which is all
+*  /dev/pirN shows. The line is never masked for it: the hard handler does
+*  not wait for the thread.
+*/
+static irqreturn_t pir_irq_thread(int irq, void *dev) 
+{
+	struct pir_sensor *pir = dev;
+	save_irq_time(pir->last_irq_time);
+	return IRQ_HANDLED;
+}
+
+/* Simulated edges, one per line: "<sensor> [<timestamp in ns>]".
+*  Without a timestamp the edge happens now. Timestamps are CLOCK_MONOTONIC
+*  and should not go back in time, as with real sensors. The lines before
+*  a malformed one are taken, and the write() returns their length: the
+*  error is only returned when the first line is malformed.
+*/
+static ssize_t pir_inject_write(struct file *file, const char __user *ubuf, 
+				size_t count, loff_t *ppos) 
 {
-	struct miscdevice *pdev = (struct miscdevice *)dev;
-	if (pdev == &pir1_device) {
-		if (t1.tv_sec == 0) {
-			getnstimeofday(&t1);
-			save_irq_time(last_irq_time_pir1, t1.tv_sec, t1.tv_nsec);
+	struct pir_array *pa = file->private_data;
+	size_t len = min_t(size_t, count, PIR_INJECT_MAX);
+	char *buf, *cur, *line, *start;
+	unsigned int sensor;
+	u64 timestamp;
+	ssize_t ret;
+	int n, end;
+
+	buf = memdup_user_nul(ubuf, len);
+	if (IS_ERR(buf))
+		return PTR_ERR(buf);
+	// A line cut by PIR_INJECT_MAX is left for the next write()
+	if (len < count) {
+		cur = strrchr(buf, '\n');
+		if (!cur) {
+			kfree(buf);
+			return -EINVAL;
 		}
+		len = cur + 1 - buf;
+		cur[1] = '\0';
 	}
-	else if (pdev == &pir2_device) {
-		if (t1.tv_sec != 0 && t2.tv_sec == 0) {
-			getnstimeofday(&t2);
-			save_irq_time(last_irq_time_pir2, t2.tv_sec, t2.tv_nsec);
-			complete(&sample_available);
+
+	ret = len;
+	cur = buf;
+	while ((start = strsep(&cur, "\n")) != NULL) {
+		line = strim(start);
+		if (*line == '\0')
+			continue;
+		// end is where the last field parsed ends, trailing junk is an error
+		end = 0;
+		n = sscanf(line, "%u%n %llu%n", &sensor, &end, &timestamp, &end);
+		if (n < 1 || line[end] != '\0' || sensor < 1 || sensor > pa->count) {
+			ret = start > buf ? start - buf : -EINVAL;
+			break;
 		}
+		if (n == 1)
+			timestamp = ktime_get_ns();
+		if (!pir_dead_time_pass(&pa->sensors[sensor - 1], timestamp))
+			continue;
+		trace_speed_pir_edge(pa->trap, sensor, timestamp);
+		pir_handle_edge(pa, sensor, timestamp);
 	}
-	else {
-		printk(KERN_WARNING "Interrupt received from unknown PIR device!\n");
-		return (irq_handler_t) IRQ_NONE;
+	kfree(buf);
+	return ret;
+}
+
+static const struct file_operations pir_inject_fops = {
+	.owner =	THIS_MODULE,
+	.open =		simple_open,
+	.write =	pir_inject_write,
+};
+
+/* Trace recorder: streams the ring from where it was when opened. A reader
+*  too slow to keep up loses the overwritten edges, and reads a
+*  PIR_EVENT_LOST record in their place. Reads return 0 once the module is
+*  being unloaded.
+*/
+struct pir_recorder {
+	struct pir_array *pa;
+	u64 pos;
+};
+
+static int pir_record_open(struct inode *inode, struct file *file) 
+{
+	struct pir_recorder *rec = kmalloc(sizeof(*rec), GFP_KERNEL);
+	if (!rec)
+		return -ENOMEM;
+	rec->pa = inode->i_private;
+	raw_spin_lock_irq(&rec->pa->ring_lock);
+	rec->pos = rec->pa->ring_head;
+	raw_spin_unlock_irq(&rec->pa->ring_lock);
+	file->private_data = rec;
+	return 0;
+}
+
+static int pir_record_release(struct inode *inode, struct file *file) 
+{
+	kfree(file->private_data);
+	return 0;
+}
+
+static bool pir_record_ready(struct pir_array *pa, u64 pos) 
+{
+	return smp_load_acquire(&pa->ring->head) != pos || READ_ONCE(pa->closing);
+}
+
+static ssize_t pir_record_read(struct file *file, char __user *ubuf, 
+			       size_t count, loff_t *ppos) 
+{
+	struct pir_recorder *rec = file->private_data;
+	struct pir_array *pa = rec->pa;
+	struct pir_trace_record *recs;
+	struct pir_event *ev;
+	u64 *pos = &rec->pos;
+	u64 lost = 0;
+	unsigned int n, i, k;
+	ssize_t ret;
+
+	n = min_t(size_t, count / sizeof(*recs), PIR_TRACE_BATCH);
+	if (n == 0)
+		return -EINVAL;
+	recs = kmalloc_array(n, sizeof(*recs), GFP_KERNEL);
+	if (!recs)
+		return -ENOMEM;
+
+	for (;;) {
+		raw_spin_lock_irq(&pa->ring_lock);
+		if (pa->ring_head - *pos > PIR_RING_SIZE) {
+			lost = pa->ring_head - PIR_RING_SIZE - *pos;
+			*pos = pa->ring_head - PIR_RING_SIZE;
+		}
+		// The gap comes first, then the edges after it
+		k = 0;
+		if (lost) {
+			recs[0].timestamp_ns = lost;
+			recs[0].sensor = 0;
+			recs[0].flags = PIR_EVENT_LOST;
+			k = 1;
+		}
+		n = k + min_t(u64, n - k, pa->ring_head - *pos);
+		for (i = k; i < n; ++i) {
+			ev = &pa->ring_events[(*pos + i - k) & (PIR_RING_SIZE - 1)];
+			recs[i].timestamp_ns = ev->timestamp_ns;
+			recs[i].sensor = ev->sensor;
+			recs[i].flags = ev->flags;
+		}
+		*pos += n - k;
+		raw_spin_unlock_irq(&pa->ring_lock);
+		if (n > 0)
+			break;
+		if (READ_ONCE(pa->closing)) {
+			ret = 0;
+			goto out;
+		}
+		if (file->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			goto out;
+		}
+		n = min_t(size_t, count / sizeof(*recs), PIR_TRACE_BATCH);
+		if (wait_event_interruptible(pa->ring_wq, pir_record_ready(pa, *pos))) {
+			ret = -ERESTARTSYS;
+			goto out;
+		}
 	}
-	return (irq_handler_t) IRQ_HANDLED;
+
+	if (lost)
+		printk(KERN_WARNING "PIR recorder too slow, %llu edges lost\n", lost);
+	ret = n * sizeof(*recs);
+	if (copy_to_user(ubuf, recs, ret))
+		ret = -EFAULT;
+out:
+	kfree(recs);
+	return ret;
+}
+
+static const struct file_operations pir_record_fops = {
+	.owner =	THIS_MODULE,
+	.open =		pir_record_open,
+	.read =		pir_record_read,
+	.release =	pir_record_release,
+};
+
+/* Replay: the first edge written to an open file happens now, the others
+*  keep their distance from it, so the runs are timed exactly as recorded.
+*  Each edge is handled as soon as it is written, or at its time with
+*  pir_replay_realtime. The runs it arms are numbered from 1.
+*/
+struct pir_replay {
+	struct pir_array *pa;
+	unsigned int runs;
+	bool started;
+	u64 trace_base;		// timestamp of the first edge in the trace
+	u64 base;		// ... and when it was replayed
+};
+
+static int pir_replay_open(struct inode *inode, struct file *file) 
+{
+	struct pir_replay *rp = kzalloc(sizeof(*rp), GFP_KERNEL);
+	if (!rp)
+		return -ENOMEM;
+	rp->pa = inode->i_private;
+	file->private_data = rp;
+	return 0;
+}
+
+static int pir_replay_release(struct inode *inode, struct file *file) 
+{
+	kfree(file->private_data);
+	return 0;
 }
 
-int dev_pir_create(struct device *parent) 
+static int pir_sleep_until(struct pir_array *pa, u64 timestamp) 
 {
+	s64 left = timestamp - ktime_get_ns();
+	int ret;
+
+	if (left <= 0)
+		return 0;
+	ret = wait_event_interruptible_hrtimeout(pa->ring_wq, READ_ONCE(pa->closing), 
+						 ns_to_ktime(left));
+	if (ret == -ETIME)
+		return 0;
+	return ret ? ret : -ESHUTDOWN;
+}
+
+/* Only takes whole records, callers write the rest again */
+static ssize_t pir_replay_write(struct file *file, const char __user *ubuf, 
+				size_t count, loff_t *ppos) 
+{
+	struct pir_replay *rp = file->private_data;
+	struct pir_array *pa = rp->pa;
+	struct pir_trace_record *recs;
+	unsigned int n, i;
+	u64 timestamp;
+	int err = 0;
+
+	n = min_t(size_t, count / sizeof(*recs), PIR_TRACE_BATCH);
+	if (n == 0)
+		return -EINVAL;
+	recs = memdup_user(ubuf, n * sizeof(*recs));
+	if (IS_ERR(recs))
+		return PTR_ERR(recs);
+
+	for (i = 0; i < n; ++i) {
+		if (recs[i].flags & (PIR_EVENT_LOST | PIR_EVENT_REJECTED))
+			continue;
+		if (recs[i].sensor < 1 || recs[i].sensor > pa->count) {
+			err = -EINVAL;
+			break;
+		}
+		if (!rp->started) {
+			rp->trace_base = recs[i].timestamp_ns;
+			rp->base = ktime_get_ns();
+			rp->started = true;
+		}
+		if (recs[i].timestamp_ns < rp->trace_base) {
+			err = -EINVAL;
+			break;
+		}
+		timestamp = rp->base + (recs[i].timestamp_ns - rp->trace_base);
+		if (READ_ONCE(pa->replay_realtime)) {
+			err = pir_sleep_until(pa, timestamp);
+			if (err)
+				break;
+		}
+		if (!pir_dead_time_pass(&pa->sensors[recs[i].sensor - 1], timestamp))
+			continue;
+		if (recs[i].sensor == 1 && (recs[i].flags & PIR_EVENT_ACCEPTED) && 
+		    pir_arm_if_idle(pa, rp->runs + 1))
+			++rp->runs;
+		trace_speed_pir_edge(pa->trap, recs[i].sensor, timestamp);
+		pir_handle_edge(pa, recs[i].sensor, timestamp);
+	}
+	kfree(recs);
+	return i > 0 ? i * sizeof(*recs) : err;
+}
+
+static const struct file_operations pir_replay_fops = {
+	.owner =	THIS_MODULE,
+	.open =		pir_replay_open,
+	.write =	pir_replay_write,
+	.release =	pir_replay_release,
+};
+
+/* Settings and rejected edges of the filter of each sensor */
+static ssize_t pir_filter_read(struct file *file, char __user *ubuf, 
+			       size_t len, loff_t *ppos) 
+{
+	struct pir_array *pa = file->private_data;
+	const size_t size = PIR_MAX_SENSORS * 160;
+	unsigned long dead_time_drops, short_pulse_drops;
+	struct pir_sensor *pir;
+	size_t cnt = 0;
+	ssize_t ret;
+	char *buf;
+
+	buf = kmalloc(size, GFP_KERNEL);
+	if (!buf)
+		return -ENOMEM;
+	for (pir = pa->sensors; pir < pa->sensors + pa->count; ++pir) {
+		raw_spin_lock_irq(&pir->filter_lock);
+		dead_time_drops = pir->dead_time_drops;
+		short_pulse_drops = pir->short_pulse_drops;
+		raw_spin_unlock_irq(&pir->filter_lock);
+		cnt += scnprintf(buf + cnt, size - cnt, 
+				 "PIR%u: dead time %u us, min pulse %u us%s, rejected %lu in dead time, %lu too short\n", 
+				 pir->index, pir->filter.dead_time_us, pir->filter.min_pulse_us, 
+				 pir->hw_debounce ? " (GPIO debounce)" : 
+				 pir->filter.min_pulse_us && !pir->min_pulse_ns ? " (unchecked)" : "", 
+				 dead_time_drops, short_pulse_drops);
+	}
+	ret = simple_read_from_buffer(ubuf, len, ppos, buf, cnt);
+	kfree(buf);
+	return ret;
+}
+
+static const struct file_operations pir_filter_fops = {
+	.owner =	THIS_MODULE,
+	.open =		simple_open,
+	.read =		pir_filter_read,
+};
+
+/* The controller debounces the line if it can, otherwise pulse_timer checks
+*  the level, as long as the pin can be read from a softirq. Either way the
+*  edge keeps the time it rose.
+*/
+static void pir_pulse_setup(struct pir_sensor *pir) 
+{
+	if (!gpio_set_debounce(pir->pin, pir->filter.min_pulse_us)) {
+		pir->hw_debounce = true;
+		pir->debounce_ns = (u64)pir->filter.min_pulse_us * NSEC_PER_USEC;
+	} else if (gpio_cansleep(pir->pin))
+		printk(KERN_WARNING "PIR%u: GPIO pin %u cannot be read from a timer, pulse width unchecked\n", 
+		       pir->index, pir->pin);
+	else
+		pir->min_pulse_ns = (u64)pir->filter.min_pulse_us * NSEC_PER_USEC;
+}
+
+/* Releases the IRQ lines and GPIO pins of the first count sensors */
+static void pir_gpio_release(struct pir_array *pa, unsigned int count) 
+{
+	struct pir_sensor *pir;
+	for (pir = pa->sensors; pir < pa->sensors + count; ++pir) {
+		free_irq(pir->irq, pir);
+		hrtimer_cancel(&pir->pulse_timer);	// it reads the pin
+		gpio_free(pir->pin);
+	}
+}
+
+static void pir_devices_deregister(struct pir_array *pa, unsigned int count) 
+{
+	while (count--)
+		misc_deregister(&pa->sensors[count].device);
+}
+
+/* Sets up the count PIRs of a trap, named with suffix. Returns an ERR_PTR()
+*  on failure.
+*/
+struct pir_array *dev_pir_create(struct device *parent, const char *suffix, 
+				 unsigned int trap, bool sim, struct dentry *debugfs, 
+				 const unsigned int *pins, const struct pir_filter *filters, 
+				 unsigned int count) 
+{
+	struct pir_array *pa;
+	struct pir_sensor *pir;
+	unsigned int i, n = 0;
 	int ret;    
 	
-	t1.tv_sec = t2.tv_sec = 0;
-	last_irq_time_pir1[0] = last_irq_time_pir2[0] = '\0';
-		
-	// Register the first PIR device
-	pir1_device.parent = parent;
-	ret = misc_register(&pir1_device);
-	if (ret)
-		return ret;
+	if (count < 2 || count > PIR_MAX_SENSORS)
+		return ERR_PTR(-EINVAL);
+	pa = kzalloc(sizeof(*pa), GFP_KERNEL);
+	if (!pa)
+		return ERR_PTR(-ENOMEM);
+	pa->sim = sim;
+	pa->trap = trap;
+	pa->count = count;
+	spin_lock_init(&pa->lock);
+	INIT_KFIFO(pa->samples);
+	init_waitqueue_head(&pa->sample_wq);
+	raw_spin_lock_init(&pa->ring_lock);
+	init_waitqueue_head(&pa->ring_wq);
 
-	// Register the first PIR device
-	pir2_device.parent = parent;
-	ret = misc_register(&pir2_device);
+	ret = pir_ring_create(pa);
 	if (ret)
-		return ret;
+		goto err_free;
+		
+	// Register a device per PIR, /dev/pir1 being the first on the track
+	for (i = 0; i < count; ++i) {
+		pir = &pa->sensors[i];
+		pir->pa = pa;
+		pir->index = i + 1;
+		pir->pin = pins[i];
+		snprintf(pir->name, sizeof(pir->name), "pir%u%s", pir->index, suffix);
+		snprintf(pir->label, sizeof(pir->label), "PIR %u", pir->index);
+		pir->filter = filters[i];
+		pir->dead_time_ns = (u64)pir->filter.dead_time_us * NSEC_PER_USEC;
+		raw_spin_lock_init(&pir->filter_lock);
+		hrtimer_init(&pir->pulse_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+		pir->pulse_timer.function = pir_pulse_timer;
+		pir->device.minor = MISC_DYNAMIC_MINOR;
+		pir->device.name = pir->name;
+		pir->device.fops = &pir_fops;
+		pir->device.parent = parent;
+		ret = misc_register(&pir->device);
+		if (ret)
+			goto err_devices;
+	}
+
+	pa->record_file = debugfs_create_file("pir_record", 0400, debugfs, pa, 
+					      &pir_record_fops);
+	pa->filter_file = debugfs_create_file("pir_filter", 0400, debugfs, pa, 
+					      &pir_filter_fops);
+	if (sim) {
+		pa->inject_file = debugfs_create_file("pir_inject", 0200, debugfs, pa, 
+						      &pir_inject_fops);
+		pa->replay_file = debugfs_create_file("pir_replay", 0200, debugfs, pa, 
+						      &pir_replay_fops);
+		pa->replay_realtime_file = debugfs_create_bool("pir_replay_realtime", 0600, 
+							       debugfs, &pa->replay_realtime);
+		return pa;
+	}
     
-	// Request GPIO pins
-	ret = gpio_request_array(pir_gpios, ARRAY_SIZE(pir_gpios));
-	if (ret) {
-	      	printk(KERN_WARNING "Failed to request PIR GPIO pins\n");
-		return ret;
-	}
-
-	irq_pir1 = gpio_to_irq(pir_gpios[0].gpio);
-	irq_pir2 = gpio_to_irq(pir_gpios[1].gpio);
-
-	// Request IRQ line
-	if (request_irq(irq_pir1, 
-			(irq_handler_t) pir_irq_handler,
-			IRQF_TRIGGER_RISING, 
-			"pir_gpio_handler", 
-			(void *)&pir1_device)) {
-		printk(KERN_ERR "GPIO PIR1: cannot register IRQ\n");
-		return -EIO;
-	}
-	if (request_irq(irq_pir2, 
-			(irq_handler_t) pir_irq_handler,
-			IRQF_TRIGGER_RISING, 
-			"pir_gpio_handler", 
-			(void *)&pir2_device)) {
-		printk(KERN_ERR "GPIO PIR2: cannot register IRQ\n");
-		return -EIO;
+	// Request the GPIO pins and IRQ lines, each IRQ gets its sensor as context
+	for (n = 0; n < count; ++n) {
+		pir = &pa->sensors[n];
+		ret = gpio_request_one(pir->pin, GPIOF_IN, pir->label);
+		if (ret) {
+			printk(KERN_WARNING "Failed to request PIR%u GPIO pin %u\n", 
+			       pir->index, pir->pin);
+			goto err_gpio;
+		}
+		if (pir->filter.min_pulse_us)
+			pir_pulse_setup(pir);
+		pir->irq = gpio_to_irq(pir->pin);
+		if (request_threaded_irq(pir->irq, 
+				pir_irq_handler, pir_irq_thread, 
+				IRQF_TRIGGER_RISING, 
+				pir->name, pir)) {
+			printk(KERN_ERR "GPIO PIR%u: cannot register IRQ\n", pir->index);
+			gpio_free(pir->pin);
+			ret = -EIO;
+			goto err_gpio;
+		}
 	}
-	
-	disable_irq(irq_pir1);	// Start with interrupts disabled
-	disable_irq(irq_pir2);
 
-	init_completion(&sample_available);
+	return pa;
 
-	return 0;
+err_gpio:
+	pir_gpio_release(pa, n);
+	debugfs_remove(pa->record_file);
+	debugfs_remove(pa->filter_file);
+err_devices:
+	pir_devices_deregister(pa, i);
+	vfree(pa->ring);
+err_free:
+	kfree(pa);
+	return ERR_PTR(ret);
 }
 
-void dev_pir_destroy(void) 
+void dev_pir_destroy(struct pir_array *pa) 
 {
-	// Release the interrupt line
-	free_irq(irq_pir1, (void *)&pir1_device);
-	free_irq(irq_pir2, (void *)&pir2_device);
-
-	// Free the GPIO pins    
-	gpio_free_array(pir_gpios, ARRAY_SIZE(pir_gpios));
+	// Removing the debugfs files waits for their readers and writers
+	WRITE_ONCE(pa->closing, true);
+	wake_up_interruptible(&pa->ring_wq);
+	debugfs_remove(pa->record_file);
+	debugfs_remove(pa->filter_file);
+	if (pa->sim) {
+		debugfs_remove(pa->inject_file);
+		debugfs_remove(pa->replay_file);
+		debugfs_remove(pa->replay_realtime_file);
+	} else {
+		// Release the interrupt lines and the GPIO pins
+		pir_gpio_release(pa, pa->count);
+	}
 
 	// Unregister the devices
-	misc_deregister(&pir1_device);
-	misc_deregister(&pir2_device);
+	pir_devices_deregister(pa, pa->count);
+
+	vfree(pa->ring);
+	kfree(pa);
 }
 
 
 static struct file_operations pir_fops = {
     .owner =	THIS_MODULE,
     .read =	pir_read,
+    .mmap =	pir_mmap,
     .open =	pir_open,
     .release = 	pir_close,
 };
-
-static struct miscdevice pir1_device = {
-    .minor = 	MISC_DYNAMIC_MINOR, 
-    .name = 	"pir1", 
-    .fops = 	&pir_fops,
-};
-
-static struct miscdevice pir2_device = {
-    .minor =	MISC_DYNAMIC_MINOR, 
-    .name = 	"pir2", 
-    .fops = 	&pir_fops,
-};
@@ -1,20 +1,46 @@
 #ifndef DEV_PIR_H
 #define DEV_PIR_H
 
-#include <linux/completion.h>
+#include <linux/debugfs.h>
 #include <linux/fs.h>
 #include <linux/init.h>
 #include <linux/kobject.h>
 #include <linux/miscdevice.h>
+#include <linux/wait.h>
 
-extern struct timespec t1, t2;
-extern struct completion sample_available;
-extern struct completion sample_consumed;
+#include "speed_uapi.h"
 
-extern unsigned int irq_pir1, irq_pir2;
+/* A completed run: one timestamp per sensor in track order, CLOCK_MONOTONIC
+*  ns. A run armed by a replayed trace rather than by a rider has its number
+*  in that trace.
+*/
+struct pir_sample {
+	unsigned int count;
+	u64 ts[PIR_MAX_SENSORS];
+	u64 queued;			// when the run was handed to the sampling thread
+	unsigned int replay_run;	// 0 if not armed by a replay
+};
 
-int dev_pir_create(struct device *parent);
-void dev_pir_destroy(void);
+/* Edge filter of a sensor, 0 turns a stage off. An edge is dropped if it
+*  comes less than dead_time_us after the last one let through, or if the
+*  output does not stay high for min_pulse_us after it (checked by the GPIO
+*  controller when it can debounce, by an hrtimer otherwise).
+*/
+struct pir_filter {
+	unsigned int dead_time_us;
+	unsigned int min_pulse_us;
+};
+
+struct pir_array;
+
+struct pir_array *dev_pir_create(struct device *parent, const char *suffix, 
+				 unsigned int trap, bool sim, struct dentry *debugfs, 
+				 const unsigned int *pins, const struct pir_filter *filters, 
+				 unsigned int count);
+void dev_pir_destroy(struct pir_array *pa);
+void pir_arm(struct pir_array *pa);
+void pir_wait_sample(struct pir_array *pa);
+bool pir_get_sample(struct pir_array *pa, struct pir_sample *s);
 
 #endif /* DEV_PIR_H */
 
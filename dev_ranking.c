@@ -1,260 +1,366 @@
-#include <linux/list.h>
-#include <linux/mutex.h>
+#include <linux/compat.h>
+#include <linux/err.h>
+#include <linux/poll.h>
+#include <linux/rculist.h>
 #include <linux/uaccess.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
 #include <linux/string.h>
+#include <linux/vmalloc.h>
 
 #include "dev_ranking.h"
 
-static struct miscdevice ranking_device;
-static struct list_head ranking_head;
-static struct mutex ranking_mutex;
-static const char format[] = "%4u | %16s | %10u.%1u | %10u.%1u\n";
-static const char header_format[] = "%4s | %16s | %12s | %12s\n%.*s\n";
-static const char hline[] = "=====================================================";
-
-struct user {
-	char name[32];
-	unsigned int best_time;
-	unsigned int best_vel;
-	struct list_head ul;
+/* /dev/ranking and /dev/ranking_snapshot, views of a ranking owned by a
+*  speed trap
+*/
+struct ranking_devices {
+	struct ranking *ranking;
+	char name[24];			// "ranking", then "ranking_N"
+	char snapshot_name[32];
+	struct miscdevice ranking_device, snapshot_device;
 };
 
-/* Finds the position to insert a new element in a sorted list (ranking)
-*  Implicitly assumes that the caller already holds a lock on the ranking
+static struct file_operations ranking_fops, snapshot_fops;
+
+/* Open snapshot: the whole dump for readers, the data received so far for
+*  writers (header first, then the entries buffer sized from it). Once a
+*  written snapshot is rejected, err fails every later write.
 */
-struct list_head *find_pos_to_insert(unsigned int time) 
+struct snapshot_file {
+	struct ranking *ranking;
+	struct ranking_snapshot_header hdr;
+	void *data;
+	size_t len;
+	size_t size;
+	int err;
+};
+
+static int snapshot_open(struct inode *inode, struct file *file)
 {
-	struct list_head *p;
-	struct user *u_next;
-	
-	// If the list is empty
-	if (ranking_head.next == &ranking_head) {
-		return &ranking_head;
-	}
-	
-	// If the element should be the first in the list
-	u_next = list_entry(ranking_head.next, struct user, ul);
-	if (time <= u_next->best_time) {
-		return &ranking_head;
-	}
-	
-	// Else iterate over the list to find the appropriate position
-	list_for_each(p, &ranking_head) {
-		if (p->next != &ranking_head) {
-			u_next = list_entry(p->next, struct user, ul);
-			if (time <= u_next->best_time)
-				return p;
+	// misc_open() left the miscdevice here
+	struct ranking_devices *rdev = container_of(file->private_data, 
+						    struct ranking_devices, snapshot_device);
+	struct snapshot_file *sf;
+
+	if ((file->f_mode & FMODE_READ) && (file->f_mode & FMODE_WRITE))
+		return -EINVAL;
+	sf = kzalloc(sizeof(*sf), GFP_KERNEL);
+	if (!sf)
+		return -ENOMEM;
+	sf->ranking = rdev->ranking;
+	if (file->f_mode & FMODE_READ) {
+		sf->data = ranking_export(sf->ranking, &sf->size);
+		if (!sf->data) {
+			kfree(sf);
+			return -ENOMEM;
 		}
+		sf->len = sf->size;
 	}
-	return ranking_head.prev;
+	file->private_data = sf;
+	return 0;
 }
 
-int add_new_user(char *name, unsigned int time, unsigned int vel) 
+static int snapshot_close(struct inode *inode, struct file *file)
 {
-	struct user *new_user = kmalloc(sizeof(struct user), GFP_KERNEL);
-	if (!new_user)
-		return -1;
-	strncpy(new_user->name, name, 31);
-	new_user->best_time = time;
-	new_user->best_vel = vel;
-	mutex_lock(&ranking_mutex);
-	list_add(&new_user->ul, find_pos_to_insert(time));
-	mutex_unlock(&ranking_mutex);
+	struct snapshot_file *sf = file->private_data;
+	vfree(sf->data);
+	kfree(sf);
 	return 0;
 }
 
-int update_user(char *name, unsigned int time, unsigned int vel)  
+static ssize_t snapshot_read(struct file *file, char __user *p, size_t len, loff_t *ppos)
 {
-	struct user *u, *next;
-	mutex_lock(&ranking_mutex);
-	list_for_each_entry_safe(u, next, &ranking_head, ul) {
-		if (!strncmp(name, u->name, 32)) {
-			if (time < u->best_time) {
-				u->best_time = time;
-				u->best_vel = vel;
-				//Reposition (no issues because returns thereafter)
-				list_del(&u->ul);
-				list_add(&u->ul, find_pos_to_insert(time));
-			}
-			mutex_unlock(&ranking_mutex);
-			return 0;
-		}
-	}
-	mutex_unlock(&ranking_mutex);
-	return 1;
+	struct snapshot_file *sf = file->private_data;
+	return simple_read_from_buffer(p, len, ppos, sf->data, sf->len);
 }
 
-int ranking_store_time(char *name, unsigned int time, unsigned int vel) 
+static ssize_t snapshot_write(struct file *file, const char __user *p, size_t len, loff_t *ppos)
 {
-	if (!update_user(name, time, vel))
-		return 0;
-	return add_new_user(name, time, vel);
-}
+	struct snapshot_file *sf = file->private_data;
+	size_t hdr_len = sizeof(sf->hdr);
+	size_t done = 0, chunk;
 
-/* buf must be at least 128 bytes long, otherwise buffer overflow may occur.*/
-unsigned int write_header(char *buf) 
-{
-	return snprintf(buf, 127, header_format, 
-			"POS", "USER", "TIME (s)", "SPEED (m/s)", 54, hline);
-}
+	if (sf->err)
+		return sf->err;
+	if (sf->len >= hdr_len && sf->len == sf->size)
+		return -EINVAL;		// already complete
 
-int get_ranking_as_str(char **pbuf) 
-{
-	unsigned int total_count = 0;
-	unsigned int w_offset = 0;
-	unsigned int true_pos = 0, prev_pos = 0, prev_time = 0;
-	char temp[128];
-	struct user *u;
-	
-	// Compute the number of bytes to be allocated
-	total_count += write_header(temp);
-	mutex_lock(&ranking_mutex);
-	list_for_each_entry(u, &ranking_head, ul) {
-		total_count += snprintf(temp, 127, format, 1, u->name, 
-					u->best_time/10, u->best_time%10, 
-					u->best_vel/10, u->best_vel%10);
+	// Header first
+	if (sf->len < hdr_len) {
+		chunk = min(len, hdr_len - sf->len);
+		if (copy_from_user((char *)&sf->hdr + sf->len, p, chunk))
+			return -EFAULT;
+		sf->len += chunk;
+		done = chunk;
+		if (sf->len < hdr_len)
+			goto out;
+		if (sf->hdr.magic != RANKING_SNAPSHOT_MAGIC || 
+		    sf->hdr.version != RANKING_SNAPSHOT_VERSION || 
+		    sf->hdr.entry_size != sizeof(struct ranking_snapshot_entry) || 
+		    sf->hdr.count > (SIZE_MAX - hdr_len) / sf->hdr.entry_size)
+			return sf->err = -EINVAL;
+		sf->size = hdr_len + (size_t)sf->hdr.count * sf->hdr.entry_size;
+		if (sf->hdr.count) {
+			sf->data = vmalloc(sf->size - hdr_len);
+			if (!sf->data)
+				return sf->err = -ENOMEM;
+		}
 	}
-	// Allocate memory dynamically
-	*pbuf = (char*)kmalloc((total_count + 1) * sizeof(char), GFP_KERNEL);
-	if (!*pbuf)
-		return -1;
-	// Generate the string
-	w_offset = write_header(temp);
-	strncpy(*pbuf, temp, w_offset  );
-	list_for_each_entry(u, &ranking_head, ul) {
-		int cnt;
-		bool exequo;
-		++true_pos;
-		exequo = u->best_time == prev_time;
-		cnt = snprintf(temp, 127, format, exequo ? prev_pos : true_pos, u->name, 
-				u->best_time/10, u->best_time%10, u->best_vel/10, u->best_vel%10);
-		strncpy(*pbuf + w_offset, temp, cnt);
-		w_offset += cnt;
-		if (!exequo) {
-			prev_time = u->best_time;
-			prev_pos = true_pos;
-		}		
+
+	// Then the entries
+	chunk = len - done;
+	if (chunk > sf->size - sf->len)
+		return sf->err = -EINVAL;	// more data than announced
+	if (copy_from_user((char *)sf->data + sf->len - hdr_len, p + done, chunk))
+		return -EFAULT;
+	sf->len += chunk;
+	done += chunk;
+
+	// Complete: load it
+	if (sf->len == sf->size) {
+		sf->err = ranking_import(sf->ranking, sf->data, sf->hdr.count);
+		if (sf->err)
+			return sf->err;
 	}
-	mutex_unlock(&ranking_mutex);
-	// Add NUL at the end
-	(*pbuf)[total_count] = '\0';
-	return total_count;
+out:
+	*ppos += done;
+	return done;
 }
 
-int get_leader(char **plead) 
+/* Open /dev/ranking: a cursor, plus the generation last read from the start
+*  for poll()
+*/
+struct ranking_reader {
+	struct ranking_iter it;
+	unsigned long seen_gen;
+};
+
+static void *ranking_seq_start(struct seq_file *m, loff_t *pos)
 {
-	struct user *u_first;
-	int cnt;
-	
-	*plead = kmalloc(256 * sizeof(char), GFP_KERNEL);
-	if (!(*plead))
-		return -1;
-	
-	mutex_lock(&ranking_mutex);
-	
-	// If empty ranking
-	if (ranking_head.next == &ranking_head)
-		cnt = snprintf(*plead, 127, "There is no leader yet!\n");
-	else {
-		cnt = write_header(*plead);
-		u_first = list_entry(ranking_head.next, struct user, ul);
-		cnt += snprintf(*plead + cnt, 127, format, 1, u_first->name, 
-				u_first->best_time/10, u_first->best_time%10, 
-				u_first->best_vel/10, u_first->best_vel%10);
+	struct ranking_reader *rd = m->private;
+
+	rcu_read_lock();
+	if (*pos == 0) {
+		rd->seen_gen = ranking_generation(rd->it.ranking);
+		return SEQ_START_TOKEN;
 	}
-	(*plead)[255] = '\0';
-	mutex_unlock(&ranking_mutex);
-	return cnt;
+	return ranking_iter_seek(&rd->it, *pos);
 }
 
-void debug_print_ranking(void) 
+static void *ranking_seq_next(struct seq_file *m, void *v, loff_t *pos)
 {
-	struct user *u;
-	mutex_lock(&ranking_mutex);
-	list_for_each_entry(u, &ranking_head, ul) {
-		printk(KERN_DEBUG "User: %s  time: %u  vel: %u\n", 
-				u->name, u->best_time, u->best_vel);
-	}
-	mutex_unlock(&ranking_mutex);
+	struct ranking_reader *rd = m->private;
+
+	++*pos;
+	if (v == SEQ_START_TOKEN)
+		ranking_iter_first(&rd->it);
+	else
+		ranking_iter_next(&rd->it);
+	return rd->it.node;
 }
 
-void flush_ranking(void) 
+static void ranking_seq_stop(struct seq_file *m, void *v)
 {
-	struct user *u, *next;
-	mutex_lock(&ranking_mutex);
-	list_for_each_entry_safe(u, next, &ranking_head, ul) {
-		list_del(&u->ul);
-		kfree(u);
-	}
-	mutex_unlock(&ranking_mutex);
-	printk(KERN_DEBUG "Leaderboard has been reset.\n");
+	rcu_read_unlock();
 }
 
-static int ranking_open(struct inode *inode, struct file *file)
+static int ranking_seq_show(struct seq_file *m, void *v)
 {
+	struct ranking_reader *rd = m->private;
+	char line[128];
+
+	if (v == SEQ_START_TOKEN)
+		ranking_print_header(line, sizeof(line));
+	else
+		ranking_print_user(line, sizeof(line), rd->it.rank, v);
+	seq_puts(m, line);
 	return 0;
 }
 
-static int ranking_close(struct inode *inode, struct file *file)
+static const struct seq_operations ranking_seq_ops = {
+	.start =	ranking_seq_start,
+	.next =		ranking_seq_next,
+	.stop =		ranking_seq_stop,
+	.show =		ranking_seq_show,
+};
+
+static long ranking_ioctl_page(struct ranking *ranking, struct ranking_page __user *argp, 
+			       bool top) 
+{
+	struct ranking_page page;
+	struct ranking_entry *entries;
+	long ret = 0;
+
+	if (copy_from_user(&page, argp, sizeof(page)))
+		return -EFAULT;
+	if (top)
+		page.offset = 0;
+	page.count = min_t(u32, page.count, RANKING_PAGE_MAX);
+	entries = kmalloc_array(page.count, sizeof(*entries), GFP_KERNEL);
+	if (!entries && page.count)
+		return -ENOMEM;
+
+	page.count = ranking_get_page(ranking, entries, page.offset, page.count, &page.total);
+	if (copy_to_user(u64_to_user_ptr(page.entries), entries, 
+			 page.count * sizeof(*entries)) || 
+	    copy_to_user(argp, &page, sizeof(page)))
+		ret = -EFAULT;
+	kfree(entries);
+	return ret;
+}
+
+static long ranking_ioctl_user(struct ranking *ranking, struct ranking_user_query __user *argp) 
 {
+	struct ranking_user_query q;
+
+	if (copy_from_user(&q, argp, sizeof(q)))
+		return -EFAULT;
+	q.name[sizeof(q.name) - 1] = '\0';
+	if (!ranking_get_user(ranking, q.name, &q.entry, &q.total))
+		return -ENOENT;
+	if (copy_to_user(argp, &q, sizeof(q)))
+		return -EFAULT;
 	return 0;
 }
 
-static ssize_t ranking_read(struct file *file, char __user *p, size_t len, loff_t *ppos)
+/* Copies the last runs of a user, oldest first */
+static long ranking_ioctl_history(struct ranking *ranking, struct ranking_history __user *argp) 
 {
-	char *s;
-	int cnt;
-	if (*ppos != 0)
-		return 0;
-	cnt = get_ranking_as_str(&s);
-	if (cnt <= 0)
-		return 0;
-	if (len < cnt)
-		cnt = len;
-	if (copy_to_user(p, s, cnt)) {
-		printk(KERN_ERR "Invalid address passed as argument to ranking_read()\n");
+	struct ranking_history h;
+	struct ranking_run *runs;
+	long ret = 0;
+
+	if (copy_from_user(&h, argp, sizeof(h)))
 		return -EFAULT;
+	h.name[sizeof(h.name) - 1] = '\0';
+	h.count = min_t(u32, h.count, RANKING_HISTORY_MAX);
+	runs = kmalloc_array(h.count, sizeof(*runs), GFP_KERNEL);
+	if (!runs && h.count)
+		return -ENOMEM;
+
+	if (!ranking_get_history(ranking, h.name, runs, &h.count, &h.total))
+		ret = -ENOENT;
+	else if (copy_to_user(u64_to_user_ptr(h.runs), runs, h.count * sizeof(*runs)) || 
+		 copy_to_user(argp, &h, sizeof(h)))
+		ret = -EFAULT;
+	kfree(runs);
+	return ret;
+}
+
+static long ranking_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+	struct seq_file *m = file->private_data;
+	struct ranking_reader *rd = m->private;
+	struct ranking *ranking = rd->it.ranking;
+	void __user *argp = (void __user *)arg;
+
+	switch (cmd) {
+	case RANKING_IOC_TOP:
+		return ranking_ioctl_page(ranking, argp, true);
+	case RANKING_IOC_PAGE:
+		return ranking_ioctl_page(ranking, argp, false);
+	case RANKING_IOC_USER:
+		return ranking_ioctl_user(ranking, argp);
+	case RANKING_IOC_HISTORY:
+		return ranking_ioctl_history(ranking, argp);
+	default:
+		return -ENOTTY;
 	}
-	kfree(s);
-	*ppos += cnt;
-	return cnt;
 }
 
-int dev_ranking_create(struct device *parent) 
+static int ranking_open(struct inode *inode, struct file *file)
 {
+	struct ranking_devices *rdev = container_of(file->private_data, 
+						    struct ranking_devices, ranking_device);
+	struct ranking_reader *rd;
+
+	// misc_open() leaves the miscdevice here, but seq_file needs it empty
+	file->private_data = NULL;
+	rd = __seq_open_private(file, &ranking_seq_ops, sizeof(struct ranking_reader));
+	if (!rd)
+		return -ENOMEM;
+	ranking_iter_init(&rd->it, rdev->ranking);
+	rd->seen_gen = ranking_generation(rdev->ranking);
+	return 0;
+}
+
+/* Readable once the ranking changed since it was last read from the start */
+static __poll_t ranking_poll(struct file *file, poll_table *wait)
+{
+	struct seq_file *m = file->private_data;
+	struct ranking_reader *rd = m->private;
+	struct ranking *ranking = rd->it.ranking;
+
+	poll_wait(file, &ranking->wq, wait);
+	if (ranking_generation(ranking) != rd->seen_gen)
+		return EPOLLIN | EPOLLRDNORM;
+	return 0;
+}
+
+/* Returns an ERR_PTR() on failure */
+struct ranking_devices *dev_ranking_create(struct device *parent, const char *suffix, 
+					   struct ranking *r) 
+{
+	struct ranking_devices *rdev;
 	int ret;    
-	
-	INIT_LIST_HEAD(&ranking_head);
-	mutex_init(&ranking_mutex);
-		
-	// Register the device
-	ranking_device.parent = parent;
-	ret = misc_register(&ranking_device);
+
+	rdev = kzalloc(sizeof(*rdev), GFP_KERNEL);
+	if (!rdev)
+		return ERR_PTR(-ENOMEM);
+	rdev->ranking = r;
+	snprintf(rdev->name, sizeof(rdev->name), "ranking%s", suffix);
+	snprintf(rdev->snapshot_name, sizeof(rdev->snapshot_name), "ranking_snapshot%s", suffix);
+
+	// Register the devices
+	rdev->ranking_device.minor = MISC_DYNAMIC_MINOR;
+	rdev->ranking_device.name = rdev->name;
+	rdev->ranking_device.fops = &ranking_fops;
+	rdev->ranking_device.parent = parent;
+	ret = misc_register(&rdev->ranking_device);
 	if (ret)
-		return ret;
-    
-	return 0;
+		goto err_free;
+	rdev->snapshot_device.minor = MISC_DYNAMIC_MINOR;
+	rdev->snapshot_device.name = rdev->snapshot_name;
+	rdev->snapshot_device.fops = &snapshot_fops;
+	rdev->snapshot_device.parent = parent;
+	ret = misc_register(&rdev->snapshot_device);
+	if (ret) {
+		misc_deregister(&rdev->ranking_device);
+		goto err_free;
+	}
+
+	return rdev;
+
+err_free:
+	kfree(rdev);
+	return ERR_PTR(ret);
 }
 
-void dev_ranking_destroy(void) 
+void dev_ranking_destroy(struct ranking_devices *rdev) 
 {
-	flush_ranking();
-	// Unregister the device    
-	misc_deregister(&ranking_device);
+	// Unregister the devices    
+	misc_deregister(&rdev->snapshot_device);
+	misc_deregister(&rdev->ranking_device);
+	kfree(rdev);
 }
 
 
 static struct file_operations ranking_fops = {
     .owner =  	THIS_MODULE,
-    .read =	ranking_read,
+    .read =	seq_read,
+    .llseek =	seq_lseek,
+    .poll =	ranking_poll,
+    .unlocked_ioctl =	ranking_ioctl,
+    .compat_ioctl =	compat_ptr_ioctl,
     .open =	ranking_open,
-    .release =	ranking_close,
+    .release =	seq_release_private,
 };
 
-static struct miscdevice ranking_device = {
-    .minor =  	MISC_DYNAMIC_MINOR, 
-    .name =  	"ranking", 
-    .fops = 	&ranking_fops,
+static struct file_operations snapshot_fops = {
+    .owner =  	THIS_MODULE,
+    .read =	snapshot_read,
+    .write =	snapshot_write,
+    .open =	snapshot_open,
+    .release =	snapshot_close,
 };
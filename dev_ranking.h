@@ -6,11 +6,12 @@
 #include <linux/kobject.h>
 #include <linux/miscdevice.h>
 
-int dev_ranking_create(struct device *parent);
-void dev_ranking_destroy(void);
-int ranking_store_time(char *name, unsigned int time, unsigned int vel);
-void flush_ranking(void);
-int get_ranking_as_str(char **pbuf);
-int get_leader(char **plead);
+#include "ranking.h"
+
+struct ranking_devices;
+
+struct ranking_devices *dev_ranking_create(struct device *parent, const char *suffix, 
+					   struct ranking *r);
+void dev_ranking_destroy(struct ranking_devices *rdev);
 
 #endif /* DEV_RANKING_H */
@@ -1,178 +1,189 @@
-#include <linux/delay.h>
+#include <linux/bitops.h>
+#include <linux/err.h>
 #include <linux/gpio.h>
-#include <linux/kthread.h>
-#include <linux/mutex.h>
+#include <linux/gpio/consumer.h>
+#include <linux/hrtimer.h>
+#include <linux/ktime.h>
+#include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/sched.h>
+#include <linux/slab.h>
 
 #include "dev_screen.h"
-
-#define MIN_REFRESH_DELAY	500
-#define MAX_REFRESH_DELAY	600
-
-#define PIN_A	21	// segment A
-#define PIN_B	20	// segment B
-#define PIN_C	16	// segment C
-#define PIN_D	12	// segment D
-#define PIN_E	7	// segment E
-#define PIN_F	8	// segment F
-#define PIN_G	25	// segment G
-#define PIN_H	24	// segment dot
-
-#define PIN_3	26	// left-most digit
-#define PIN_2	19
-#define PIN_1	13
-#define PIN_0	11	// right-most digit
-
-static unsigned int digit_segments[][7] = {
-	{1, 1, 1, 1, 1, 1, 0},	// 0
-	{0, 1, 1, 0, 0, 0, 0},	// 1
-	{1, 1, 0, 1, 1, 0, 1},	// 2
-	{1, 1, 1, 1, 0, 0, 1},	// 3
-	{0, 1, 1, 0, 0, 1, 1},	// 4
-	{1, 0, 1, 1, 0, 1, 1},	// 5
-	{1, 0, 1, 1, 1, 1, 1},	// 6
-	{1, 1, 1, 0, 0, 0, 0},	// 7
-	{1, 1, 1, 1, 1, 1, 1},	// 8
-	{1, 1, 1, 1, 0, 1, 1}	// 9
+#include "latency.h"
+#include "speed_trace.h"
+
+#define REFRESH_PERIOD_NS	500000		// one digit every 500 us
+#define IDLE_PERIOD_NS		1000000000	// idle pattern moves every second
+
+/* Glyphs are segment bitmasks, bit i driving pin i of the screen */
+#define SEG_A	BIT(0)
+#define SEG_B	BIT(1)
+#define SEG_C	BIT(2)
+#define SEG_D	BIT(3)
+#define SEG_E	BIT(4)
+#define SEG_F	BIT(5)
+#define SEG_G	BIT(6)
+#define SEG_DOT	BIT(7)
+
+#define DIGIT_PIN_BASE	8		// digit selects follow the segments
+#define DIGIT_PINS	4
+#define DIGIT_SELECT(d)	BIT(DIGIT_PIN_BASE + (d))	// digit d, right-most is 0
+
+static const u8 digit_glyphs[] = {
+	SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F,		// 0
+	SEG_B | SEG_C,						// 1
+	SEG_A | SEG_B | SEG_D | SEG_E | SEG_G,			// 2
+	SEG_A | SEG_B | SEG_C | SEG_D | SEG_G,			// 3
+	SEG_B | SEG_C | SEG_F | SEG_G,				// 4
+	SEG_A | SEG_C | SEG_D | SEG_F | SEG_G,			// 5
+	SEG_A | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G,		// 6
+	SEG_A | SEG_B | SEG_C,					// 7
+	SEG_A | SEG_B | SEG_C | SEG_D | SEG_E | SEG_F | SEG_G,	// 8
+	SEG_A | SEG_B | SEG_C | SEG_D | SEG_F | SEG_G,		// 9
 };
 
-static unsigned int default_segments[] =
-	{0, 0, 0, 0, 0, 0, 1};	// -
-
-static struct gpio screen_gpios[] = {
-	{ PIN_A, GPIOF_OUT_INIT_LOW, "Screen segment A" },
-	{ PIN_B, GPIOF_OUT_INIT_LOW, "Screen segment B" },
-	{ PIN_C, GPIOF_OUT_INIT_LOW, "Screen segment C" },
-	{ PIN_D, GPIOF_OUT_INIT_LOW, "Screen segment D" },
-	{ PIN_E, GPIOF_OUT_INIT_LOW, "Screen segment E" },
-	{ PIN_F, GPIOF_OUT_INIT_LOW, "Screen segment F" },
-	{ PIN_G, GPIOF_OUT_INIT_LOW, "Screen segment G" },
-	{ PIN_H, GPIOF_OUT_INIT_LOW, "Screen segment dot" },
-	{ PIN_0, GPIOF_OUT_INIT_LOW, "Screen digit 0" },
-	{ PIN_1, GPIOF_OUT_INIT_LOW, "Screen digit 1" },
-	{ PIN_2, GPIOF_OUT_INIT_LOW, "Screen digit 2" },
-	{ PIN_3, GPIOF_OUT_INIT_LOW, "Screen digit 3" },
+static const u8 default_glyph = SEG_G;	// -
+
+static const char *const screen_labels[SCREEN_PINS] = {
+	"Screen segment A", "Screen segment B", "Screen segment C", "Screen segment D", 
+	"Screen segment E", "Screen segment F", "Screen segment G", "Screen segment dot", 
+	"Screen digit 0", "Screen digit 1", "Screen digit 2", "Screen digit 3", 
 };
 
-static struct miscdevice screen_device;  //forward declaration
-static struct task_struct *idle_screen_thread_desc;
-static unsigned int last_num_displayed = 10000;
-static unsigned int last_num_dot_pos;
-static struct mutex last_num_mutex;
+static struct file_operations screen_fops;
+
+/* The screen is refreshed by a single hrtimer, scanning one digit per tick
+*  out of a framebuffer. display_number() only fills the framebuffer and
+*  switches the mode; the result mode falls back to idle at result_end.
+*  A screen without pins has nothing to refresh: its timer only fires once,
+*  at result_end.
+*/
+enum screen_mode {
+	SCREEN_IDLE,
+	SCREEN_RESULT,
+};
 
-static void reset_default_segments(void) 
-{
-	unsigned int i;
-	for (i = 0; i < 7; ++i) {
-		gpio_set_value(screen_gpios[i].gpio, default_segments[i]);
-	}
-}
+struct screen {
+	bool sim;			// no pins: the framebuffer is refreshed into the void
+	struct gpio gpios[SCREEN_PINS];
+	struct gpio_desc *descs[SCREEN_PINS];	// same order, to set them in batches
+	struct hrtimer refresh_timer;	// with sim, only armed until result_end
+	spinlock_t lock;
+	enum screen_mode mode;
+	u8 fb[DIGIT_PINS];		// glyphs, right-most digit first
+	ktime_t result_end;
+	ktime_t result_start;		// while its first refresh is pending
+	bool first_refresh;
+	unsigned int scan_pos;		// digit refreshed by the next tick
+	unsigned int last_num_displayed;
+	unsigned int last_num_dot_pos;
+	char name[16];			// "screen", then "screen_N"
+	unsigned int trap;		// owner, for the tracepoints
+	struct miscdevice device;
+};
 
-static void clear_digit_pins(void) 
+static void clear_digit_pins(struct screen *s) 
 {
-	unsigned int i;
-	for (i = 0; i < 4; ++i) {
-		gpio_set_value(screen_gpios[i + 8].gpio, 0);
-	}
+	unsigned long values = 0;
+	if (s->sim)
+		return;
+	gpiod_set_array_value(DIGIT_PINS, s->descs + DIGIT_PIN_BASE, NULL, &values);
 }
 
-static int idle_screen_thread(void *arg) 
+/* Shows a glyph on a digit with two batched writes: the digits are switched
+*  off first, so the new segments never light up the previous digit.
+*/
+static void display_glyph(struct screen *s, unsigned int digit, u8 glyph) 
 {
-	unsigned int digit_pos = 0;
-	unsigned int i;
+	unsigned long values = glyph | DIGIT_SELECT(digit);
 
-	while(!kthread_should_stop()) {
-		// Clear all the four digit pins
-		for (i = 0; i < 4; ++i) {
-			gpio_set_value(screen_gpios[i + 8].gpio, 0);
-		}
-		// Prepare the default pattern
-		reset_default_segments();
-
-		// Show it in the right digit (reversed pos)
-		gpio_set_value(screen_gpios[8 + 3 - digit_pos].gpio, 1);
-		digit_pos = (digit_pos + 1) % 4;
-		set_current_state(TASK_INTERRUPTIBLE);
-		schedule_timeout(HZ);
-	}
-	return 0;
+	if (s->sim)
+		return;
+	clear_digit_pins(s);
+	gpiod_set_array_value(SCREEN_PINS, s->descs, NULL, &values);
 }
 
-static int start_idle_screen_thread(void) 
+static enum hrtimer_restart screen_refresh(struct hrtimer *timer) 
 {
-	if (idle_screen_thread_desc != NULL) {
-		printk(KERN_WARNING "Can't start the idle screen thread because it's already running!\n");
-		return 1;
+	struct screen *s = container_of(timer, struct screen, refresh_timer);
+	unsigned long flags;
+	u64 period;
+
+	spin_lock_irqsave(&s->lock, flags);
+	if (s->mode == SCREEN_RESULT && ktime_after(ktime_get(), s->result_end)) {
+		trace_speed_display_stop(s->trap, s->last_num_displayed);
+		s->mode = SCREEN_IDLE;
+		s->scan_pos = 0;
 	}
-	idle_screen_thread_desc = kthread_run(idle_screen_thread, NULL, "idle_speed_screen");
-	if (IS_ERR(idle_screen_thread_desc)) {
-		printk(KERN_WARNING "Failed to initialize the screen with the idle pattern.\n");
-		return PTR_ERR(idle_screen_thread_desc);
+	if (s->mode == SCREEN_RESULT) {
+		if (s->first_refresh) {
+			latency_record(LAT_DISPLAY_REFRESH, 
+				       ktime_to_ns(ktime_sub(ktime_get(), s->result_start)));
+			s->first_refresh = false;
+		}
+		display_glyph(s, s->scan_pos, s->fb[s->scan_pos]);
+		period = REFRESH_PERIOD_NS;
+	} else {
+		// Default pattern in a single digit, moving left to right
+		display_glyph(s, DIGIT_PINS - 1 - s->scan_pos, default_glyph);
+		period = IDLE_PERIOD_NS;
 	}
-	return 0;
-}
+	s->scan_pos = (s->scan_pos + 1) % DIGIT_PINS;
+	spin_unlock_irqrestore(&s->lock, flags);
 
-static int stop_idle_screen_thread(void) 
-{
-	if (idle_screen_thread_desc == NULL) {
-		printk(KERN_WARNING "Can't stop the idle screen thread because it wasn't running!\n");
-		return 1;
-	}
-	kthread_stop(idle_screen_thread_desc);
-	idle_screen_thread_desc = NULL;
-	return 0;
+	hrtimer_forward_now(timer, ns_to_ktime(period));
+	return HRTIMER_RESTART;
 }
 
-static int display_digit(unsigned int digit, unsigned int value, bool dot) 
+static enum hrtimer_restart screen_result_timeout(struct hrtimer *timer) 
 {
-	unsigned int i;
-
-	if (digit > 3 || value > 9)
-		return 1;
-	
-	// Clear digit pins
-	clear_digit_pins();
-
-	// Set the appropriate digit pin
-	gpio_set_value(screen_gpios[digit + 8].gpio, 1);
-
-	// Set the appropriate segments
-	for (i = 0; i < 7; ++i) {
-		gpio_set_value(screen_gpios[i].gpio, digit_segments[value][i]);
-	}
-	gpio_set_value(screen_gpios[7].gpio, dot ? 1 : 0);
-	return 0;
+	struct screen *s = container_of(timer, struct screen, refresh_timer);
+	unsigned long flags;
+
+	spin_lock_irqsave(&s->lock, flags);
+	trace_speed_display_stop(s->trap, s->last_num_displayed);
+	s->mode = SCREEN_IDLE;
+	spin_unlock_irqrestore(&s->lock, flags);
+	return HRTIMER_NORESTART;
 }
 
-int display_number(unsigned int value, unsigned int msecs, unsigned int dot_pos) {
-	unsigned int t;
-	unsigned int digit_pos = 0;
-	unsigned int digits[4];
-	const unsigned int refresh_loops = 1000 * msecs / MIN_REFRESH_DELAY;
+int display_number(struct screen *s, unsigned int value, unsigned int msecs, 
+		   unsigned int dot_pos) {
+	unsigned long flags;
+	unsigned int i;
 
 	if (value > 9999)
 		return 1;
 		
-	mutex_lock(&last_num_mutex);
-	last_num_displayed = value;
-	last_num_dot_pos = dot_pos;
-	mutex_unlock(&last_num_mutex);
-
-	digits[0] = value % 10;
-	digits[1] = value / 10 % 10;
-	digits[2] = value / 100 % 10;
-	digits[3] = value / 1000;
-
-	stop_idle_screen_thread();
-
-	for (t = 0; t < refresh_loops; ++t) {
-		display_digit(digit_pos, digits[digit_pos], digit_pos == dot_pos);
-		digit_pos = (digit_pos + 1) % 4;		
-		usleep_range(MIN_REFRESH_DELAY, MAX_REFRESH_DELAY);
+	trace_speed_display_start(s->trap, value, dot_pos, msecs);
+	spin_lock_irqsave(&s->lock, flags);
+	s->last_num_displayed = value;
+	s->last_num_dot_pos = dot_pos;
+
+	for (i = 0; i < DIGIT_PINS; ++i) {
+		s->fb[i] = digit_glyphs[value % 10] | (i == dot_pos ? SEG_DOT : 0);
+		value /= 10;
 	}
-
-	start_idle_screen_thread();
+	s->result_start = ktime_get();
+	s->first_refresh = !s->sim;
+	s->result_end = ktime_add_ms(s->result_start, msecs);
+	s->mode = SCREEN_RESULT;
+	s->scan_pos = 0;
+	spin_unlock_irqrestore(&s->lock, flags);
+
+	// The timer forwards itself, so it must not be running while it is
+	// re-armed. Without pins, the number is "displayed" as soon as it is
+	// in the framebuffer, and the timer only ends the result.
+	hrtimer_cancel(&s->refresh_timer);
+	if (s->sim) {
+		latency_record(LAT_DISPLAY_REFRESH, 
+			       ktime_to_ns(ktime_sub(ktime_get(), s->result_start)));
+		hrtimer_start(&s->refresh_timer, ms_to_ktime(msecs), HRTIMER_MODE_REL);
+		return 0;
+	}
+	// Refresh now rather than at the end of an idle period
+	hrtimer_start(&s->refresh_timer, 0, HRTIMER_MODE_REL);
 	return 0;
 }
 
@@ -188,23 +199,30 @@ static int screen_close(struct inode *inode, struct file *file)
 
 static ssize_t screen_read(struct file *file, char __user *p, size_t len, loff_t *ppos)
 {
+	// misc_open() left the miscdevice here
+	struct screen *s = container_of(file->private_data, struct screen, device);
 	char buf[32];
 	unsigned int i;
-	int cnt, divisor = 1;
+	unsigned long flags;
+	unsigned int divisor = 1;
+	int cnt;
 	
 	if (*ppos != 0)
 		return 0;
 		
-	mutex_lock(&last_num_mutex);
-	if (last_num_dot_pos < 4) {
-		for (i = 0; i < last_num_dot_pos; ++i)
+	spin_lock_irqsave(&s->lock, flags);
+	if (s->last_num_dot_pos < 4) {
+		for (i = 0; i < s->last_num_dot_pos; ++i)
 			divisor *= 10;
 	}
-	if (last_num_displayed >= 10000)	// default value
-		cnt = snprintf(buf, 31, "No number displayed yet!\n");
-	else
-		cnt = snprintf(buf, 7, "%d.%d\n", last_num_displayed / divisor, last_num_displayed % divisor);
-	mutex_unlock(&last_num_mutex);
+	if (s->last_num_displayed >= 10000)	// default value
+		cnt = scnprintf(buf, sizeof(buf), "No number displayed yet!\n");
+	else if (divisor == 1)
+		cnt = scnprintf(buf, sizeof(buf), "%u\n", s->last_num_displayed);
+	else	// as many decimals as digits after the dot, 1005 is "1.005"
+		cnt = scnprintf(buf, sizeof(buf), "%u.%0*u\n", s->last_num_displayed / divisor, 
+				(int)s->last_num_dot_pos, s->last_num_displayed % divisor);
+	spin_unlock_irqrestore(&s->lock, flags);
 	
 	buf[cnt] = '\0';
 	if (copy_to_user(p, buf, cnt)) {
@@ -215,47 +233,83 @@ static ssize_t screen_read(struct file *file, char __user *p, size_t len, loff_t
 	return cnt;
 }
 
-int dev_screen_create(struct device *parent) 
+/* A screen without pins only keeps the last number, for the sim backend or
+*  a trap without a display. Returns an ERR_PTR() on failure.
+*/
+struct screen *dev_screen_create(struct device *parent, const char *suffix, 
+				 unsigned int trap, const unsigned int *pins) 
 {
+	struct screen *s;
+	unsigned int i;
 	int ret;    
 	
-	mutex_init(&last_num_mutex);
+	s = kzalloc(sizeof(*s), GFP_KERNEL);
+	if (!s)
+		return ERR_PTR(-ENOMEM);
+	s->sim = pins == NULL;
+	s->trap = trap;
+	spin_lock_init(&s->lock);
+	s->mode = SCREEN_IDLE;
+	s->last_num_displayed = 10000;
 		
 	// Register the device
-	screen_device.parent = parent;
-	ret = misc_register(&screen_device);
+	snprintf(s->name, sizeof(s->name), "screen%s", suffix);
+	s->device.minor = MISC_DYNAMIC_MINOR;
+	s->device.name = s->name;
+	s->device.fops = &screen_fops;
+	s->device.parent = parent;
+	ret = misc_register(&s->device);
 	if (ret)
-		return ret;
+		goto err_free;
     
 	// Request GPIO pins
-	ret = gpio_request_array(screen_gpios, ARRAY_SIZE(screen_gpios));
-	if (ret) {
-	      	printk(KERN_WARNING "Failed to request screen GPIO pins\n");
-		return ret;
+	if (!s->sim) {
+		for (i = 0; i < SCREEN_PINS; ++i) {
+			s->gpios[i].gpio = pins[i];
+			s->gpios[i].flags = GPIOF_OUT_INIT_LOW;
+			s->gpios[i].label = screen_labels[i];
+		}
+		ret = gpio_request_array(s->gpios, SCREEN_PINS);
+		if (ret) {
+		      	printk(KERN_WARNING "Failed to request screen GPIO pins\n");
+			goto err_deregister;
+		}
+		for (i = 0; i < SCREEN_PINS; ++i)
+			s->descs[i] = gpio_to_desc(s->gpios[i].gpio);
 	}
 
-	// Show the default pattern
-	ret = start_idle_screen_thread();
-	if (ret) {
-		printk(KERN_WARNING "Failed to initialize the screen with the idle pattern.\n");
-		return ret;
+	hrtimer_init(&s->refresh_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL);
+	if (s->sim) {
+		s->refresh_timer.function = screen_result_timeout;
+		return s;
 	}
-	return 0;
+	// Start refreshing, with the default pattern
+	s->refresh_timer.function = screen_refresh;
+	hrtimer_start(&s->refresh_timer, 0, HRTIMER_MODE_REL);
+	return s;
+
+err_deregister:
+	misc_deregister(&s->device);
+err_free:
+	kfree(s);
+	return ERR_PTR(ret);
 }
 
-void dev_screen_destroy(void) 
+void dev_screen_destroy(struct screen *s) 
 {
-	// Stop the thread showing the idle pattern on the screen
-	stop_idle_screen_thread();
+	// Stop refreshing the screen
+	hrtimer_cancel(&s->refresh_timer);
 
 	// Remove leftover output 
-	clear_digit_pins();
+	clear_digit_pins(s);
 
 	// Free the GPIO pins    
-	gpio_free_array(screen_gpios, ARRAY_SIZE(screen_gpios));
+	if (!s->sim)
+		gpio_free_array(s->gpios, SCREEN_PINS);
 
 	// Unregister the device    
-	misc_deregister(&screen_device);
+	misc_deregister(&s->device);
+	kfree(s);
 }
 
 
@@ -265,9 +319,3 @@ static struct file_operations screen_fops = {
     .open = 	screen_open,
     .release = 	screen_close,
 };
-
-static struct miscdevice screen_device = {
-    .minor = 	MISC_DYNAMIC_MINOR, 
-    .name = 	"screen", 
-    .fops = 	&screen_fops,
-};
@@ -6,9 +6,34 @@
 #include <linux/kobject.h>
 #include <linux/miscdevice.h>
 
-int dev_screen_create(struct device *parent);
-void dev_screen_destroy(void);
-int display_number(unsigned int value, unsigned int msecs, unsigned int dot_pos);
+/* Wiring of a screen: the segments A to G and the dot, then the digits from
+*  the right-most one
+*/
+#define SCREEN_PINS	12
 
-#endif /* DEV_SCREEN_H */
+#define PIN_A	21	// segment A
+#define PIN_B	20	// segment B
+#define PIN_C	16	// segment C
+#define PIN_D	12	// segment D
+#define PIN_E	7	// segment E
+#define PIN_F	8	// segment F
+#define PIN_G	25	// segment G
+#define PIN_H	24	// segment dot
+
+#define PIN_3	26	// left-most digit
+#define PIN_2	19
+#define PIN_1	13
+#define PIN_0	11	// right-most digit
+
+#define SCREEN_DEFAULT_PINS \
+	{ PIN_A, PIN_B, PIN_C, PIN_D, PIN_E, PIN_F, PIN_G, PIN_H, PIN_0, PIN_1, PIN_2, PIN_3 }
 
+struct screen;
+
+struct screen *dev_screen_create(struct device *parent, const char *suffix,
+				 unsigned int trap, const unsigned int *pins);
+void dev_screen_destroy(struct screen *s);
+int display_number(struct screen *s, unsigned int value, unsigned int msecs,
+		   unsigned int dot_pos);
+
+#endif /* DEV_SCREEN_H */
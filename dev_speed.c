@@ -1,8 +1,11 @@
-#include <linux/completion.h>
+#include <linux/debugfs.h>
+#include <linux/err.h>
+#include <linux/fs.h>
 #include <linux/interrupt.h>
 #include <linux/kthread.h>
 #include <linux/ktime.h>
 #include <linux/mutex.h>
+#include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 #include <linux/wait.h>
@@ -11,52 +14,91 @@
 #include "dev_screen.h"
 #include "dev_pir.h"
 #include "dev_ranking.h"
+#include "latency.h"
+#include "speed_math.h"
+#include "speed_trace.h"
 
-static struct miscdevice speed_device;
-static struct task_struct *speed_sampling_thread_desc;
-static char *username;
-static int username_len;
-static struct mutex username_mutex;
-static struct completion dev_speed_comp;
-unsigned int pir_dist;
+#define RIDER_QUEUE_LEN	16
+
+/* One speed trap: its PIRs, screen, ranking and 'speed' device, served by
+*  its own sampling thread. Traps share nothing, so lanes never wait on each
+*  other. The first trap keeps the historical names, the others get "_N"
+*  appended to all of theirs (speed_1, pir1_1, ranking_1...).
+*/
+struct speed_trap {
+	unsigned int id;
+	char suffix[8];
+	char name[16];
+	struct miscdevice device;
+	struct task_struct *sampling_thread;
+	struct dentry *debugfs;
+	struct screen *screen;
+	struct pir_array *pir;
+	struct ranking *ranking;
+	struct ranking_devices *ranking_devs;
+	unsigned int pir_dist;
+
+	/* FIFO of registered riders. The head is the next one to complete a
+	*  run: each rider in the queue gave the PIRs one run with pir_arm(), so
+	*  runs come back from the sensors in the same order.
+	*/
+	char riders[RIDER_QUEUE_LEN][RANKING_NAME_LEN];
+	unsigned int riders_head, riders_count;
+	struct mutex riders_mutex;
+	wait_queue_head_t riders_wq;	// riders waiting for a free slot
+
+	/* Results processed so far, for poll() */
+	unsigned long results;
+	wait_queue_head_t results_wq;
+};
+
+static struct speed_trap *traps[SPEED_MAX_TRAPS];
+static unsigned int trap_count;
+
+static struct file_operations speed_fops;
+
+struct speed_file {
+	struct speed_trap *trap;
+	unsigned long seen_results;
+};
+
+/* misc_register() made the miscdevice the drvdata of its device */
+static struct speed_trap *kobj_to_trap(struct kobject *kobj) 
+{
+	struct miscdevice *misc = dev_get_drvdata(kobj_to_dev(kobj));
+	return container_of(misc, struct speed_trap, device);
+}
 
 static ssize_t leaderboard_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf) 
 {
-	int ret;
-	char *ranking_str;
-	ret = get_ranking_as_str(&ranking_str);
-	if (ret <= 0)
-		return ret;
-	strcpy(buf, ranking_str);
-	kfree(ranking_str);
-	return ret;
+	return ranking_print(kobj_to_trap(kobj)->ranking, buf, PAGE_SIZE);
 }
 
 static ssize_t leader_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf) 
 {
-	int ret;
-	char *leader_str;
-	ret = get_leader(&leader_str);
-	if (ret <= 0)
-		return ret;
-	strcpy(buf, leader_str);
-	kfree(leader_str);
-	return ret;
+	return ranking_print_leader(kobj_to_trap(kobj)->ranking, buf, PAGE_SIZE);
+}
+
+static ssize_t stats_show(struct kobject *kobj, struct kobj_attribute *attr, char *buf) 
+{
+	return ranking_print_stats(kobj_to_trap(kobj)->ranking, buf, PAGE_SIZE);
 }
 
 static ssize_t reset_store(struct kobject *kobj, struct kobj_attribute *attr, const char *buf, size_t count) 
 {
-	flush_ranking();
+	ranking_flush(kobj_to_trap(kobj)->ranking);
 	return count;
 }
 
 static struct kobj_attribute leaderboard_attr = __ATTR_RO(leaderboard);
 static struct kobj_attribute leader_attr = __ATTR_RO(leader);
+static struct kobj_attribute stats_attr = __ATTR_RO(stats);
 static struct kobj_attribute reset_attr = __ATTR_WO(reset);
 
 static struct attribute *speed_attrs[] = {
       &leaderboard_attr.attr,
       &leader_attr.attr,
+      &stats_attr.attr,
       &reset_attr.attr,
       NULL,
 };
@@ -66,230 +108,342 @@ static struct attribute_group attr_group = {
       .attrs = speed_attrs,
 };
 
+/* Shows a time on the 4 digits with as many decimals as fit */
+static void display_time(struct speed_trap *t, unsigned int time_us, unsigned int msecs) 
+{
+	unsigned int value = time_us / 1000;	// milliseconds
+	unsigned int dot_pos = 3;
+
+	while (value > 9999 && dot_pos > 0) {
+		value /= 10;
+		--dot_pos;
+	}
+	display_number(t->screen, min(value, 9999U), msecs, dot_pos);
+}
+
+/* Removes the rider at the head of the queue, who just completed a run */
+static void pop_rider(struct speed_trap *t, char *name) 
+{
+	mutex_lock(&t->riders_mutex);
+	if (t->riders_count == 0) {
+		strcpy(name, "unknown");
+	} else {
+		strcpy(name, t->riders[t->riders_head]);
+		t->riders_head = (t->riders_head + 1) % RIDER_QUEUE_LEN;
+		--t->riders_count;
+	}
+	mutex_unlock(&t->riders_mutex);
+	wake_up_interruptible(&t->riders_wq);
+}
+
 static int speed_sampling_thread(void *arg) 
 {
-	long delta_dsec;
-	unsigned int vel;
+	struct speed_trap *t = arg;
+	char username[RANKING_NAME_LEN];
+	u32 splits[RANKING_SPLITS_MAX];
+	struct pir_sample s;
+	u64 delta_us, t1, t2;
+	unsigned int vel, nsplits;
 	while(!kthread_should_stop()) {
-		while(true) {
+		pir_wait_sample(t->pir);
+		while (pir_get_sample(t->pir, &s)) {
 			int ret;
-			wait_for_completion(&sample_available);
-			disable_irq(irq_pir1);
-			disable_irq(irq_pir2);
-			// if missing data, the thread was woken up by the closing function
-			if (t1.tv_sec == 0 || t2.tv_sec == 0)
-				break;
+			t1 = s.ts[0];
+			t2 = s.ts[s.count - 1];
+			// Not from t2, which may be dated back by the edge filter
+			latency_record(LAT_IRQ_TO_THREAD, ktime_get_ns() - s.queued);
+			if (s.replay_run)	// armed by a replay, not by a rider
+				snprintf(username, sizeof(username), "replay_%u", s.replay_run);
+			else
+				pop_rider(t, username);
+			trace_speed_sample(t->id, username, t1, t2);
 				
 			// Process the data coming from sensors
-			delta_dsec = 10 * (t2.tv_sec - t1.tv_sec) + 
-				     (t2.tv_nsec / 100000000) - (t1.tv_nsec / 100000000);
-			vel = 10 * pir_dist / delta_dsec;	// decimeters / seconds
-			ret = ranking_store_time(username, delta_dsec, vel);
-			if (ret)
-				printk(KERN_WARNING "Failed to add user to the ranking\n");
-			display_number(delta_dsec, 5000, 1);
-
-			t1.tv_sec = 0;
-			t2.tv_sec = 0;
-			kfree(username);
-			username = NULL;
-			complete(&dev_speed_comp);
+			delta_us = speed_run_time_us(t1, t2);
+			if (!speed_run_time_valid(delta_us)) {
+				printk(KERN_WARNING "Discarding run with an invalid time\n");
+			} else {
+				vel = speed_velocity(t->pir_dist * (s.count - 1), delta_us);
+				nsplits = speed_splits_us(s.ts, s.count, splits);
+				ret = ranking_store_time(t->ranking, username, delta_us, vel, 
+							 splits, nsplits);
+				if (ret)
+					printk(KERN_WARNING "Failed to add user to the ranking\n");
+				display_time(t, delta_us, 5000);
+			}
+			WRITE_ONCE(t->results, t->results + 1);
+			wake_up_interruptible(&t->results_wq);
 		}
 	}
-	enable_irq(irq_pir1);	// reenable IRQs as at the beginning
-	enable_irq(irq_pir2);
 	printk(KERN_DEBUG "Closing speed sampling thread\n");
 	return 0;
 }
 
 static int speed_open(struct inode *inode, struct file *file)
 {
+	// misc_open() left our miscdevice there
+	struct speed_trap *t = container_of(file->private_data, struct speed_trap, device);
+	struct speed_file *sf = kzalloc(sizeof(*sf), GFP_KERNEL);
+	if (!sf)
+		return -ENOMEM;
+	sf->trap = t;
+	sf->seen_results = READ_ONCE(t->results);
+	file->private_data = sf;
 	return 0;
 }
 
 static int speed_close(struct inode *inode, struct file *file)
 {
+	kfree(file->private_data);
 	return 0;
 }
 
+/* Readable after each new result, writable while the queue has room */
+static __poll_t speed_poll(struct file *file, poll_table *wait)
+{
+	struct speed_file *sf = file->private_data;
+	struct speed_trap *t = sf->trap;
+	__poll_t mask = 0;
+
+	poll_wait(file, &t->results_wq, wait);
+	poll_wait(file, &t->riders_wq, wait);
+	if (READ_ONCE(t->results) != sf->seen_results)
+		mask |= EPOLLIN | EPOLLRDNORM;
+	if (READ_ONCE(t->riders_count) < RIDER_QUEUE_LEN)
+		mask |= EPOLLOUT | EPOLLWRNORM;
+	return mask;
+}
+
+/* Lists the queued riders, the one up next first */
 static ssize_t speed_read(struct file *file, char __user *buf, size_t len, loff_t *ppos)
 {
-	int err, read_bytes;
-	char temp[username_len+2]; 	// '\n' and '\0'
+	struct speed_file *sf = file->private_data;
+	struct speed_trap *t = sf->trap;
+	const size_t size = RIDER_QUEUE_LEN * (RANKING_NAME_LEN + 8);
+	unsigned int i;
+	ssize_t ret;
+	size_t cnt = 0;
+	char *temp;
 	
-	if (*ppos != 0)
-		return 0;
-	
-	mutex_lock(&username_mutex);
-	if (username == NULL) {
-		mutex_unlock(&username_mutex);
-		return 0;
-	}
-	if (len > username_len)
-		read_bytes = username_len;
-	else
-		read_bytes = len;
+	temp = kmalloc(size, GFP_KERNEL);
+	if (!temp)
+		return -ENOMEM;
 	
-	read_bytes = snprintf(temp, read_bytes + 1, "%s\n", username);
-	temp[read_bytes++] = '\0';
+	sf->seen_results = READ_ONCE(t->results);
+	mutex_lock(&t->riders_mutex);
+	for (i = 0; i < t->riders_count; ++i)
+		cnt += scnprintf(temp + cnt, size - cnt, "%2u: %s\n", i + 1, 
+				 t->riders[(t->riders_head + i) % RIDER_QUEUE_LEN]);
+	mutex_unlock(&t->riders_mutex);
 		
-	err = copy_to_user(buf, temp, read_bytes);
-	if (err) {
-		mutex_unlock(&username_mutex);
-		return -EFAULT;
-	}
-	
-	mutex_unlock(&username_mutex);
-	*ppos += read_bytes;
-	return read_bytes;
+	ret = simple_read_from_buffer(buf, len, ppos, temp, cnt);
+	kfree(temp);
+	return ret;
 }
 
 
 static ssize_t speed_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos) 
 {
-	int err;
-	if (try_wait_for_completion(&dev_speed_comp)) {
-		// Store the username
-		mutex_lock(&username_mutex);
-		if (username) {
-			mutex_unlock(&username_mutex);
-			return -1;
-		}
-		username = kmalloc(count, GFP_USER);
-		if (username == NULL) {
-			mutex_unlock(&username_mutex);
-			return -1;
-		}
-		username_len = count;
-		
-		err = copy_from_user(username, buf, count);
-		if (err) {
-			mutex_unlock(&username_mutex);
-			return -EFAULT;
-		}
-		username[count-1] = '\0';	// replace \n with \0
-		mutex_unlock(&username_mutex);
-		// Enable IRQ from PIR1 and PIR2
-		enable_irq(irq_pir1);
-		enable_irq(irq_pir2);
-		return count;
+	struct speed_file *sf = file->private_data;
+	struct speed_trap *t = sf->trap;
+	char name[RANKING_NAME_LEN];
+	size_t len = min(count, sizeof(name) - 1);
+	char *trimmed;
+
+	if (copy_from_user(name, buf, len))
+		return -EFAULT;
+	name[len] = '\0';
+	trimmed = strim(name);	// drop the trailing '\n'
+	if (*trimmed == '\0')
+		return -EINVAL;
+
+	mutex_lock(&t->riders_mutex);
+	while (t->riders_count == RIDER_QUEUE_LEN) {
+		mutex_unlock(&t->riders_mutex);
+		if (file->f_flags & O_NONBLOCK)
+			return -EAGAIN;
+		if (wait_event_interruptible(t->riders_wq, 
+				READ_ONCE(t->riders_count) < RIDER_QUEUE_LEN))
+			return -ERESTARTSYS;
+		mutex_lock(&t->riders_mutex);
 	}
-	return -1;
+	// Enqueue the rider and let the PIRs time one more run
+	strcpy(t->riders[(t->riders_head + t->riders_count) % RIDER_QUEUE_LEN], trimmed);
+	++t->riders_count;
+	pir_arm(t->pir);
+	mutex_unlock(&t->riders_mutex);
+	return count;
 }
 
-int dev_speed_create(unsigned int sensors_dist) 
+/* Builds trap id with all its devices, returns an ERR_PTR() on failure */
+static struct speed_trap *speed_trap_create(const struct speed_config *cfg, unsigned int id) 
 {
-    	int ret;
+    	struct speed_trap *t;
     	struct kobject *kobj;
-    	
-    	pir_dist = sensors_dist;
+    	int ret;
+
+    	t = kzalloc(sizeof(*t), GFP_KERNEL);
+    	if (!t)
+    		return ERR_PTR(-ENOMEM);
+    	t->id = id;
+    	if (id)
+    		snprintf(t->suffix, sizeof(t->suffix), "_%u", id);
+    	snprintf(t->name, sizeof(t->name), "speed%s", t->suffix);
+    	t->pir_dist = cfg->sensors_dist;
+
+	/* Initialize the riders queue */
+	mutex_init(&t->riders_mutex);
+	init_waitqueue_head(&t->riders_wq);
+	init_waitqueue_head(&t->results_wq);
 
 	/* Register 'speed' device */
-    	if (misc_register(&speed_device)) {
-    		printk(KERN_ERR "Failed to register 'speed' device as misc.\n");
-    		ret = 1;
+	t->device.minor = MISC_DYNAMIC_MINOR;
+	t->device.name = t->name;
+	t->device.fops = &speed_fops;
+    	ret = misc_register(&t->device);
+    	if (ret) {
+    		printk(KERN_ERR "Failed to register '%s' device as misc.\n", t->name);
         	goto exit1;
         }
-    
-    	/* Add 'speed' and its attributes to sysfs */
-    	kobj = &speed_device.this_device->kobj;
-    	if (sysfs_create_group(kobj, &attr_group)) {
-        	dev_err(speed_device.this_device, "Failed to create sysfs group for 'speed' device.\n");
-        	ret = 2;
-        	goto exit2;
-    	}
-    
-    	if (sysfs_create_link(kernel_kobj, kobj, "speed")) {
-		dev_err(speed_device.this_device, "Failed to add sysfs like for 'speed' device.\n");
-		ret = 3;
-		goto exit3;
-	}
+
+	/* Debugging files, failures are not fatal. The latency histograms are
+	*  per-CPU and shared by all the traps, they only show up in the first
+	*  one's directory.
+	*/
+	t->debugfs = debugfs_create_dir(t->name, NULL);
+	if (id == 0)
+		latency_debugfs_create(t->debugfs);
 
 	/* Create 'screen' device */
-	if (dev_screen_create(speed_device.this_device)) {
-		dev_err(speed_device.this_device, "Failed to create  'screen' device.\n");
-		ret = 4;
-    		goto exit4;
+	t->screen = dev_screen_create(t->device.this_device, t->suffix, id, 
+				      cfg->sim || id >= cfg->screens ? NULL : cfg->screen_pins[id]);
+	if (IS_ERR(t->screen)) {
+		dev_err(t->device.this_device, "Failed to create  'screen' device.\n");
+		ret = PTR_ERR(t->screen);
+    		goto exit2;
     	}
     	
     	/* Create 'pir' device */
-	if (dev_pir_create(speed_device.this_device)) {
-		dev_err(speed_device.this_device, "Failed to create  'pir' device.\n");
-		ret = 5;
-		goto exit5;
-	}
-	
-	/* Create 'ranking' device */
-	if (dev_ranking_create(speed_device.this_device)) {
-		dev_err(speed_device.this_device, "Failed to create  'ranking' device.\n");
-		ret = 6;
-		goto exit6;
+	t->pir = dev_pir_create(t->device.this_device, t->suffix, id, cfg->sim, t->debugfs, 
+				cfg->pir_pins[id], cfg->pir_filters, cfg->pir_count);
+	if (IS_ERR(t->pir)) {
+		dev_err(t->device.this_device, "Failed to create  'pir' device.\n");
+		ret = PTR_ERR(t->pir);
+		goto exit3;
 	}
 
-	/* Initialize semaphores */
-	mutex_init(&username_mutex);
-	init_completion(&dev_speed_comp);
-	complete(&dev_speed_comp);
+	/* Create the ranking and its devices */
+	t->ranking = ranking_create(t->suffix, id, cfg->ranking_reserve, cfg->history_len);
+	if (!t->ranking) {
+		dev_err(t->device.this_device, "Failed to create the ranking.\n");
+		ret = -ENOMEM;
+		goto exit4;
+	}
+	t->ranking_devs = dev_ranking_create(t->device.this_device, t->suffix, t->ranking);
+	if (IS_ERR(t->ranking_devs)) {
+		dev_err(t->device.this_device, "Failed to create  'ranking' device.\n");
+		ranking_destroy(t->ranking);
+		ret = PTR_ERR(t->ranking_devs);
+		goto exit4;
+	}
 
 	/* Start the thread for processing samples */
-	speed_sampling_thread_desc = kthread_run(speed_sampling_thread, NULL, "speed sampling thread");
-	if (IS_ERR(speed_sampling_thread_desc)) {
+	t->sampling_thread = kthread_run(speed_sampling_thread, t, "speed%s sampling thread", 
+					 t->suffix);
+	if (IS_ERR(t->sampling_thread)) {
 		printk(KERN_ERR "Failed to initialize the thread to handle the speed sampling.\n");
-		ret = 7;
+		ret = PTR_ERR(t->sampling_thread);
+		goto exit5;
+	}
+
+	/* Add 'speed' and its attributes to sysfs, last: they use everything
+	*  above
+	*/
+	kobj = &t->device.this_device->kobj;
+	ret = sysfs_create_group(kobj, &attr_group);
+	if (ret) {
+		dev_err(t->device.this_device, "Failed to create sysfs group for 'speed' device.\n");
+		goto exit6;
+	}
+
+	ret = sysfs_create_link(kernel_kobj, kobj, t->name);
+	if (ret) {
+		dev_err(t->device.this_device, "Failed to add sysfs like for 'speed' device.\n");
 		goto exit7;
 	}
-	
+
 	/* Here means that every previous action succeeded */
-	printk("Speed device created (minor = %d)\n", speed_device.minor);
-	ret = 0;
-	goto exit0;
+	printk("Speed device '%s' created (minor = %d)\n", t->name, t->device.minor);
+	return t;
 
 exit7:
-	dev_ranking_destroy();
+	sysfs_remove_group(kobj, &attr_group);
 exit6:
-	dev_pir_destroy();
+	kthread_stop(t->sampling_thread);
 exit5:
-	dev_screen_destroy();	
+	dev_ranking_destroy(t->ranking_devs);
+	ranking_destroy(t->ranking);
 exit4:
-	sysfs_remove_link(kernel_kobj, "speed");
+	dev_pir_destroy(t->pir);
 exit3:
-	sysfs_remove_group(&speed_device.this_device->kobj, &attr_group);
-exit2:    
-	misc_deregister(&speed_device);
+	dev_screen_destroy(t->screen);
+exit2:
+	debugfs_remove_recursive(t->debugfs);
+	misc_deregister(&t->device);
 exit1:
-exit0:
-	return ret;
+	kfree(t);
+	return ERR_PTR(ret);
+}
+
+static void speed_trap_destroy(struct speed_trap *t) 
+{
+	// The sysfs attributes use the rest, they go first
+	sysfs_remove_link(kernel_kobj, t->name);
+	sysfs_remove_group(&t->device.this_device->kobj, &attr_group);
+	kthread_stop(t->sampling_thread);
+	dev_ranking_destroy(t->ranking_devs);
+	ranking_destroy(t->ranking);
+	dev_pir_destroy(t->pir);
+	dev_screen_destroy(t->screen);
+	debugfs_remove_recursive(t->debugfs);
+	misc_deregister(&t->device);
+	kfree(t);
+}
+
+int dev_speed_create(const struct speed_config *cfg) 
+{
+	struct speed_trap *t;
+
+	if (cfg->traps == 0 || cfg->traps > SPEED_MAX_TRAPS)
+		return -EINVAL;
+	for (trap_count = 0; trap_count < cfg->traps; ++trap_count) {
+		t = speed_trap_create(cfg, trap_count);
+		if (IS_ERR(t)) {
+			dev_speed_destroy();
+			return PTR_ERR(t);
+		}
+		traps[trap_count] = t;
+	}
+	return 0;
 }
 
 void dev_speed_destroy(void) 
 {
-	// if the thread was waiting for a sample, wake it up
-	complete(&sample_available);
-	kthread_stop(speed_sampling_thread_desc);
-	dev_ranking_destroy();
-	dev_pir_destroy();
-	dev_screen_destroy();
-	sysfs_remove_link(kernel_kobj, "speed");
-	sysfs_remove_group(&speed_device.this_device->kobj, &attr_group);
-	misc_deregister(&speed_device);
+	while (trap_count > 0)
+		speed_trap_destroy(traps[--trap_count]);
 }
 
+/* The first trap, the one with the historical names */
 struct miscdevice* dev_speed_get_ptr(void) 
 {
-   	return &speed_device;
+   	return &traps[0]->device;
 }
 
 static struct file_operations speed_fops = {
    	.owner = 	THIS_MODULE,
     	.read = 	speed_read,
 	.write =	speed_write,
+	.poll =		speed_poll,
     	.open = 	speed_open,
     	.release =	speed_close,
 };
-
-static struct miscdevice speed_device = {
-    	MISC_DYNAMIC_MINOR, 
-	"speed", 
-	&speed_fops
-};
-
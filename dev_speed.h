@@ -6,7 +6,28 @@
 #include <linux/kobject.h>
 #include <linux/miscdevice.h>
 
-int dev_speed_create(unsigned int sensors_dist);
+#include "dev_pir.h"
+#include "dev_screen.h"
+#include "speed_uapi.h"
+
+/* Independent speed traps (lanes) run by the module */
+#define SPEED_MAX_TRAPS	4
+
+/* Settings of the speed traps, from the module parameters */
+struct speed_config {
+	unsigned int sensors_dist;	// decimeters between two consecutive PIRs
+	unsigned int ranking_reserve;
+	unsigned int history_len;
+	bool sim;
+	unsigned int traps;
+	unsigned int pir_count;		// per trap
+	unsigned int pir_pins[SPEED_MAX_TRAPS][PIR_MAX_SENSORS];	// in track order
+	struct pir_filter pir_filters[PIR_MAX_SENSORS];		// same in every trap
+	unsigned int screens;		// traps from the first one with a display
+	unsigned int screen_pins[SPEED_MAX_TRAPS][SCREEN_PINS];
+};
+
+int dev_speed_create(const struct speed_config *cfg);
 void dev_speed_destroy(void);
 struct miscdevice* dev_speed_get_ptr(void);
 
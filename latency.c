@@ -0,0 +1,116 @@
+#include <linux/bitops.h>
+#include <linux/debugfs.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/percpu.h>
+#include <linux/seq_file.h>
+#include <linux/string.h>
+
+#include "latency.h"
+
+#define LAT_BUCKETS	32	// bucket b counts [2^(b-1), 2^b) ns, the last one the rest
+
+struct lat_hist {
+	u64 buckets[LAT_BUCKETS];
+	u64 count;
+	u64 sum;
+	u64 min;
+	u64 max;
+};
+
+/* Each CPU updates its own histograms with preemption disabled, and each
+*  stage is only measured from one kind of context, so no lock is needed.
+*  Readers sum the CPUs without stopping the writers.
+*/
+struct lat_cpu {
+	struct lat_hist hist[LAT_COUNT];
+};
+
+static DEFINE_PER_CPU(struct lat_cpu, lat_cpu);
+
+static const char *const lat_names[LAT_COUNT] = {
+	[LAT_IRQ_TO_THREAD] =	"irq_to_thread",
+	[LAT_RANKING_STORE] =	"ranking_store",
+	[LAT_DISPLAY_REFRESH] =	"display_refresh",
+};
+
+void latency_record(enum speed_latency stage, u64 ns) 
+{
+	struct lat_hist *h = &get_cpu_ptr(&lat_cpu)->hist[stage];
+
+	++h->buckets[min_t(unsigned int, fls64(ns), LAT_BUCKETS - 1)];
+	if (h->count == 0 || ns < h->min)
+		h->min = ns;
+	if (ns > h->max)
+		h->max = ns;
+	h->sum += ns;
+	++h->count;
+	put_cpu_ptr(&lat_cpu);
+}
+
+static void latency_sum(enum speed_latency stage, struct lat_hist *total) 
+{
+	struct lat_hist *h;
+	unsigned int b;
+	int cpu;
+
+	memset(total, 0, sizeof(*total));
+	for_each_possible_cpu(cpu) {
+		h = &per_cpu_ptr(&lat_cpu, cpu)->hist[stage];
+		if (h->count == 0)
+			continue;
+		for (b = 0; b < LAT_BUCKETS; ++b)
+			total->buckets[b] += h->buckets[b];
+		if (total->count == 0 || h->min < total->min)
+			total->min = h->min;
+		total->max = max(total->max, h->max);
+		total->sum += h->sum;
+		total->count += h->count;
+	}
+}
+
+static int latency_show(struct seq_file *m, void *v) 
+{
+	struct lat_hist total;
+	unsigned int stage, b;
+
+	for (stage = 0; stage < LAT_COUNT; ++stage) {
+		latency_sum(stage, &total);
+		seq_printf(m, "%s: count %llu min %llu mean %llu max %llu (ns)\n", 
+			   lat_names[stage], total.count, total.min, 
+			   total.count ? div64_u64(total.sum, total.count) : 0, total.max);
+		for (b = 0; b < LAT_BUCKETS; ++b) {
+			if (!total.buckets[b])
+				continue;
+			if (b == LAT_BUCKETS - 1)
+				seq_printf(m, "  >= %10llu: %llu\n", 1ULL << (b - 1), total.buckets[b]);
+			else
+				seq_printf(m, "  < %11llu: %llu\n", 1ULL << b, total.buckets[b]);
+		}
+	}
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(latency);
+
+/* Races with concurrent updates at worst lose them */
+static ssize_t latency_reset_write(struct file *file, const char __user *buf, 
+				   size_t count, loff_t *ppos) 
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		memset(per_cpu_ptr(&lat_cpu, cpu), 0, sizeof(struct lat_cpu));
+	return count;
+}
+
+static const struct file_operations latency_reset_fops = {
+	.owner =	THIS_MODULE,
+	.write =	latency_reset_write,
+};
+
+void latency_debugfs_create(struct dentry *dir) 
+{
+	debugfs_create_file("latency", 0444, dir, NULL, &latency_fops);
+	debugfs_create_file("latency_reset", 0200, dir, NULL, &latency_reset_fops);
+}
@@ -0,0 +1,18 @@
+#ifndef LATENCY_H
+#define LATENCY_H
+
+#include <linux/debugfs.h>
+#include <linux/types.h>
+
+/* Stages of a run whose latency is always measured */
+enum speed_latency {
+	LAT_IRQ_TO_THREAD,	// run queued by the last PIR edge to the sampling thread
+	LAT_RANKING_STORE,	// ranking_store_time() under the ranking mutex
+	LAT_DISPLAY_REFRESH,	// display_number() to the first refresh (sim: to the framebuffer)
+	LAT_COUNT,
+};
+
+void latency_record(enum speed_latency stage, u64 ns);
+void latency_debugfs_create(struct dentry *dir);
+
+#endif /* LATENCY_H */
@@ -3,6 +3,7 @@
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/stat.h>
+#include <linux/string.h>
 
 #include "dev_speed.h"
 
@@ -12,13 +13,89 @@ MODULE_LICENSE("GPL");
 
 static unsigned int sensors_dist = 100;
 module_param(sensors_dist, uint, S_IRUGO);
-MODULE_PARM_DESC(sensors_dist, "Distance between PIR sensors (decimeters)");
+MODULE_PARM_DESC(sensors_dist, "Distance between two consecutive PIR sensors (decimeters)");
+
+static unsigned int traps = 1;
+module_param(traps, uint, S_IRUGO);
+MODULE_PARM_DESC(traps, "Independent speed traps, each with its own sensors, display and ranking (1 to 4)");
+
+static unsigned int pir_pins[PIR_MAX_SENSORS * SPEED_MAX_TRAPS] = { 15, 18 };
+static unsigned int pir_count = 2;
+module_param_array(pir_pins, uint, &pir_count, S_IRUGO);
+MODULE_PARM_DESC(pir_pins, "GPIO pins of the PIR sensors in track order, 2 to 8 per trap, split evenly between the traps (only their number matters with the sim backend)");
+
+static unsigned int pir_dead_time_us[PIR_MAX_SENSORS];
+static unsigned int pir_dead_time_count;
+module_param_array(pir_dead_time_us, uint, &pir_dead_time_count, S_IRUGO);
+MODULE_PARM_DESC(pir_dead_time_us, "Edges ignored after one is taken (microseconds), per PIR in track order or one value for all, 0 for none");
+
+static unsigned int pir_min_pulse_us[PIR_MAX_SENSORS];
+static unsigned int pir_min_pulse_count;
+module_param_array(pir_min_pulse_us, uint, &pir_min_pulse_count, S_IRUGO);
+MODULE_PARM_DESC(pir_min_pulse_us, "Shortest PIR output pulse taken as an edge (microseconds), per PIR in track order or one value for all, 0 for any");
+
+static unsigned int screen_pins[SCREEN_PINS * SPEED_MAX_TRAPS] = SCREEN_DEFAULT_PINS;
+static unsigned int screen_count = SCREEN_PINS;
+module_param_array(screen_pins, uint, &screen_count, S_IRUGO);
+MODULE_PARM_DESC(screen_pins, "GPIO pins of the displays, 12 per trap: segments A to G, dot, then digits from the right-most one. Traps past the last display have none");
+
+static unsigned int ranking_reserve = 64;
+module_param(ranking_reserve, uint, S_IRUGO);
+MODULE_PARM_DESC(ranking_reserve, "Ranking entries kept in reserve for memory pressure");
+
+static unsigned int history_len = 8;
+module_param(history_len, uint, S_IRUGO);
+MODULE_PARM_DESC(history_len, "Recent runs kept per user (at most 64)");
+
+static char *backend = "gpio";
+module_param(backend, charp, S_IRUGO);
+MODULE_PARM_DESC(backend, "gpio for the real sensors and display, sim to inject PIR edges from debugfs");
 
 static int __init speed_module_init(void)
 {
+    struct speed_config cfg = {
+        .sensors_dist = sensors_dist,
+        .ranking_reserve = ranking_reserve,
+        .history_len = history_len,
+        .traps = traps,
+    };
+    unsigned int i;
     int res;
+
+    if (!strcmp(backend, "sim")) {
+        cfg.sim = true;
+    } else if (!strcmp(backend, "gpio")) {
+        cfg.sim = false;
+    } else {
+        printk(KERN_ERR "Unknown backend %s\n", backend);
+        return -EINVAL;
+    }
+    if (traps < 1 || traps > SPEED_MAX_TRAPS) {
+        printk(KERN_ERR "Between 1 and %d traps are supported\n", SPEED_MAX_TRAPS);
+        return -EINVAL;
+    }
+    cfg.pir_count = pir_count / traps;
+    if (cfg.pir_count * traps != pir_count || cfg.pir_count < 2 ||
+        cfg.pir_count > PIR_MAX_SENSORS) {
+        printk(KERN_ERR "Each trap needs the same number of PIR sensors, 2 to %d\n",
+               PIR_MAX_SENSORS);
+        return -EINVAL;
+    }
+    if (screen_count % SCREEN_PINS) {
+        printk(KERN_ERR "Each display needs %d pins\n", SCREEN_PINS);
+        return -EINVAL;
+    }
+    cfg.screens = screen_count / SCREEN_PINS;
+    for (i = 0; i < traps; i++)
+        memcpy(cfg.pir_pins[i], pir_pins + i * cfg.pir_count,
+               cfg.pir_count * sizeof(*pir_pins));
+    memcpy(cfg.screen_pins, screen_pins, sizeof(screen_pins));
+    for (i = 0; i < PIR_MAX_SENSORS; i++) {
+        cfg.pir_filters[i].dead_time_us = pir_dead_time_us[pir_dead_time_count == 1 ? 0 : i];
+        cfg.pir_filters[i].min_pulse_us = pir_min_pulse_us[pir_min_pulse_count == 1 ? 0 : i];
+    }
     
-    res = dev_speed_create(sensors_dist);
+    res = dev_speed_create(&cfg);
     if (res < 0) {
         printk(KERN_ERR "Failed to create the speed device.\n");
         return res;
@@ -0,0 +1,678 @@
+#include <linux/export.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/ktime.h>
+#include <linux/mempool.h>
+#include <linux/mutex.h>
+#include <linux/rbtree_augmented.h>
+#include <linux/rculist.h>
+#include <linux/seqlock.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+
+#include "latency.h"
+#include "ranking.h"
+#include "run_stats.h"
+#include "speed_trace.h"
+
+static const char format[] = "%4u | %16s | %5u.%06u | %8u.%03u\n";
+static const char header_format[] = "%4s | %16s | %12s | %12s\n%.*s\n";
+static const char hline[] = "=====================================================";
+
+#define user_entry(n) rb_entry(n, struct ranking_user, node)
+
+static inline unsigned int subtree_size(struct rb_node *n) 
+{
+	return n ? user_entry(n)->subtree_size : 0;
+}
+
+static inline bool user_compute_size(struct ranking_user *u, bool exit) 
+{
+	unsigned int size = 1 + subtree_size(u->node.rb_left) + subtree_size(u->node.rb_right);
+	if (exit && u->subtree_size == size)
+		return true;
+	u->subtree_size = size;
+	return false;
+}
+
+RB_DECLARE_CALLBACKS(static, user_size_cb, struct ranking_user, node, subtree_size, user_compute_size);
+
+/* Links a user in the ranking tree and list, ordered by best time.
+*  Ties go to the right, so users with the same time keep the order in which
+*  they achieved it (which is what the ex-aequo numbering relies on).
+*  Implicitly assumes that the caller already holds a lock on the ranking
+*  and is inside a seq write section
+*/
+static void ranking_insert(struct ranking *r, struct ranking_user *new_user) 
+{
+	struct rb_node **link = &r->root.rb_root.rb_node;
+	struct rb_node *parent = NULL;
+	bool leftmost = true;
+
+	while (*link) {
+		parent = *link;
+		user_entry(parent)->subtree_size++;
+		if (new_user->best_time < user_entry(parent)->best_time) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+	new_user->subtree_size = 1;
+	rb_link_node_rcu(&new_user->node, parent, link);
+	rb_insert_augmented_cached(&new_user->node, &r->root, leftmost, &user_size_cb);
+
+	parent = rb_prev(&new_user->node);
+	list_add_rcu(&new_user->ul, parent ? &user_entry(parent)->ul : &r->head);
+}
+
+/* Implicitly assumes that the caller already holds a lock on the ranking.
+*  Must come after the unlinking of every user the change removes and before
+*  their call_rcu(), see ranking_iter_seek(). Pollers are only woken once the
+*  write section ends.
+*/
+static void ranking_changed(struct ranking *r) 
+{
+	smp_store_release(&r->gen, r->gen + 1);
+}
+
+static void free_user_rcu(struct rcu_head *head) 
+{
+	struct ranking_user *u = container_of(head, struct ranking_user, rcu);
+	mempool_free(u, u->pool);
+}
+
+static u32 user_hash(const char *name) 
+{
+	return jhash(name, strlen(name), 0);
+}
+
+/* Looks up a user by name (already truncated to fit struct ranking_user).
+*  Implicitly assumes that the caller already holds a lock on the ranking
+*/
+static struct ranking_user *find_user(struct ranking *r, const char *name, u32 hash) 
+{
+	struct ranking_user *u;
+	hash_for_each_possible(r->table, u, hnode, hash) {
+		if (!strcmp(name, u->name))
+			return u;
+	}
+	return NULL;
+}
+
+static void history_reset(struct ranking_user *u) 
+{
+	u->runs = u->history_head = u->history_count = 0;
+}
+
+/* Implicitly assumes that the caller already holds a lock on the ranking
+*  and is inside a seq write section
+*/
+static void history_add(struct ranking *r, struct ranking_user *u, 
+			const struct ranking_run *run) 
+{
+	++u->runs;
+	if (r->history_len == 0)
+		return;
+	u->history[u->history_head] = *run;
+	u->history_head = (u->history_head + 1) % r->history_len;
+	if (u->history_count < r->history_len)
+		++u->history_count;
+}
+
+/* Stores a new result in the history of the user, adding them if unknown.
+*  The user is only updated and repositioned if the new time is a personal
+*  best. splits are the times of the segments between the sensors, kept with
+*  the run in the history.
+*/
+int ranking_store_time(struct ranking *r, const char *name, unsigned int time, 
+		       unsigned int vel, const u32 *splits, unsigned int nsplits) 
+{
+	char key[RANKING_NAME_LEN];
+	struct ranking_user *u, *old;
+	struct ranking_run run = {
+		.timestamp_ns =	ktime_get_real_ns(),
+		.time_us =	time,
+		.vel =		vel,
+		.nsplits =	min(nsplits, (unsigned int)RANKING_SPLITS_MAX),
+	};
+	u64 locked;
+	u32 hash;
+
+	memcpy(run.splits_us, splits, run.nsplits * sizeof(*splits));
+	strscpy(key, name, sizeof(key));
+	hash = user_hash(key);
+
+	mutex_lock(&r->mutex);
+	locked = ktime_get_ns();
+	run_hist_add(&r->time_hist, time);
+	run_hist_add(&r->vel_hist, vel);
+	old = find_user(r, key, hash);
+	trace_speed_ranking_update(r->trap, key, time, vel, old != NULL, 
+				   !old || time < old->best_time);
+	if (old && time >= old->best_time) {
+		write_seqcount_begin(&r->seq);
+		history_add(r, old, &run);
+		write_seqcount_end(&r->seq);
+		latency_record(LAT_RANKING_STORE, ktime_get_ns() - locked);
+		mutex_unlock(&r->mutex);
+		return 0;
+	}
+
+	// Never fails: waits for the reserve to be refilled if memory is short
+	u = mempool_alloc(r->pool, GFP_KERNEL);
+	u->pool = r->pool;
+	strcpy(u->name, key);
+	u->best_time = time;
+	u->best_vel = vel;
+	if (old) {
+		u->runs = old->runs;
+		u->history_head = old->history_head;
+		u->history_count = old->history_count;
+		memcpy(u->history, old->history, r->history_len * sizeof(*u->history));
+	} else {
+		history_reset(u);
+	}
+	history_add(r, u, &run);
+	write_seqcount_begin(&r->seq);
+	if (old) {
+		// Reposition: readers may briefly see both entries, never none
+		rb_erase_augmented_cached(&old->node, &r->root, &user_size_cb);
+		ranking_insert(r, u);
+		hlist_replace_rcu(&old->hnode, &u->hnode);
+		list_del_rcu(&old->ul);
+	} else {
+		ranking_insert(r, u);
+		hash_add_rcu(r->table, &u->hnode, hash);
+		++r->count;
+	}
+	ranking_changed(r);
+	if (old)
+		call_rcu(&old->rcu, free_user_rcu);
+	write_seqcount_end(&r->seq);
+	wake_up_interruptible(&r->wq);
+	latency_record(LAT_RANKING_STORE, ktime_get_ns() - locked);
+	mutex_unlock(&r->mutex);
+	return 0;
+}
+EXPORT_SYMBOL_GPL(ranking_store_time);
+
+int ranking_print_header(char *buf, size_t size) 
+{
+	return scnprintf(buf, size, header_format, 
+			"POS", "USER", "TIME (s)", "SPEED (m/s)", 54, hline);
+}
+
+int ranking_print_user(char *buf, size_t size, unsigned int rank, 
+		       const struct ranking_user *u) 
+{
+	return scnprintf(buf, size, format, rank, u->name, 
+			u->best_time / 1000000, u->best_time % 1000000, 
+			u->best_vel / 1000, u->best_vel % 1000);
+}
+EXPORT_SYMBOL_GPL(ranking_print_user);
+
+/* The cursor functions must be called under rcu_read_lock() */
+void ranking_iter_init(struct ranking_iter *it, struct ranking *r) 
+{
+	it->ranking = r;
+	it->node = NULL;
+}
+EXPORT_SYMBOL_GPL(ranking_iter_init);
+
+void ranking_iter_first(struct ranking_iter *it) 
+{
+	struct ranking *r = it->ranking;
+	it->gen = smp_load_acquire(&r->gen);
+	it->node = list_first_or_null_rcu(&r->head, struct ranking_user, ul);
+	it->pos = 1;
+	it->rank = 1;
+}
+EXPORT_SYMBOL_GPL(ranking_iter_first);
+
+void ranking_iter_next(struct ranking_iter *it) 
+{
+	unsigned int prev_time = it->node->best_time;
+	it->node = list_next_or_null_rcu(&it->ranking->head, &it->node->ul, 
+					 struct ranking_user, ul);
+	++it->pos;
+	if (it->node && it->node->best_time != prev_time)
+		it->rank = it->pos;
+}
+EXPORT_SYMBOL_GPL(ranking_iter_next);
+
+/* Moves the cursor to the pos-th user, reusing its current position when the
+*  ranking did not change in the meantime, so that sequential reads do not
+*  walk the ranking from the beginning every time.
+*  A cached user is only dereferenced if gen did not move since it was
+*  reached. Writers bump gen once the users they remove are unlinked and
+*  before they call_rcu() them: a reader that sees the new gen restarts from
+*  a list they are no longer on, and one that still sees the old gen is in a
+*  read-side section that the grace period of those users has to wait for.
+*/
+struct ranking_user *ranking_iter_seek(struct ranking_iter *it, loff_t pos) 
+{
+	if (!it->node || it->gen != smp_load_acquire(&it->ranking->gen) || it->pos > pos)
+		ranking_iter_first(it);
+	while (it->node && it->pos < pos)
+		ranking_iter_next(it);
+	return it->node;
+}
+EXPORT_SYMBOL_GPL(ranking_iter_seek);
+
+/* Prints as much of the leaderboard as fits in buf (e.g. a sysfs page).
+*  The full leaderboard can always be streamed from /dev/ranking.
+*/
+int ranking_print(struct ranking *r, char *buf, size_t size) 
+{
+	static const char more[] = "...\n";
+	struct ranking_iter it;
+	char line[128];
+	size_t cnt;
+	int len;
+
+	cnt = ranking_print_header(buf, size);
+	ranking_iter_init(&it, r);
+	rcu_read_lock();
+	for (ranking_iter_first(&it); it.node; ranking_iter_next(&it)) {
+		len = ranking_print_user(line, sizeof(line), it.rank, it.node);
+		if (cnt + len + sizeof(more) > size) {
+			cnt += scnprintf(buf + cnt, size - cnt, "%s", more);
+			break;
+		}
+		memcpy(buf + cnt, line, len + 1);
+		cnt += len;
+	}
+	rcu_read_unlock();
+	return cnt;
+}
+
+int ranking_print_leader(struct ranking *r, char *buf, size_t size) 
+{
+	struct ranking_user *u_first;
+	int cnt;
+
+	rcu_read_lock();
+
+	// If empty ranking
+	u_first = list_first_or_null_rcu(&r->head, struct ranking_user, ul);
+	if (!u_first)
+		cnt = scnprintf(buf, size, "There is no leader yet!\n");
+	else {
+		cnt = ranking_print_header(buf, size);
+		cnt += ranking_print_user(buf + cnt, size - cnt, 1, u_first);
+	}
+	rcu_read_unlock();
+	return cnt;
+}
+
+/* Prints the median, p90 and p99 of the time and speed of all runs since the
+*  last reset, personal bests or not. The histograms make this O(1) in the
+*  number of runs and users.
+*/
+int ranking_print_stats(struct ranking *r, char *buf, size_t size) 
+{
+	static const unsigned int percents[] = { 50, 90, 99 };
+	u32 times[ARRAY_SIZE(percents)], vels[ARRAY_SIZE(percents)];
+	u64 runs;
+
+	mutex_lock(&r->mutex);
+	runs = run_hist_quantiles(&r->time_hist, percents, times, ARRAY_SIZE(percents));
+	run_hist_quantiles(&r->vel_hist, percents, vels, ARRAY_SIZE(percents));
+	mutex_unlock(&r->mutex);
+
+	return scnprintf(buf, size, 
+			 "runs: %llu\n"
+			 "time (s):    p50 %u.%06u  p90 %u.%06u  p99 %u.%06u\n"
+			 "speed (m/s): p50 %u.%03u  p90 %u.%03u  p99 %u.%03u\n",
+			 runs, 
+			 times[0] / 1000000, times[0] % 1000000,
+			 times[1] / 1000000, times[1] % 1000000,
+			 times[2] / 1000000, times[2] % 1000000,
+			 vels[0] / 1000, vels[0] % 1000,
+			 vels[1] / 1000, vels[1] % 1000,
+			 vels[2] / 1000, vels[2] % 1000);
+}
+
+void ranking_debug_print(struct ranking *r) 
+{
+	struct ranking_user *u;
+	rcu_read_lock();
+	list_for_each_entry_rcu(u, &r->head, ul) {
+		printk(KERN_DEBUG "User: %s  time: %u  vel: %u\n", 
+				u->name, u->best_time, u->best_vel);
+	}
+	rcu_read_unlock();
+}
+
+/* Implicitly assumes that the caller already holds a lock on the ranking */
+static void ranking_flush_locked(struct ranking *r) 
+{
+	struct rb_root old = r->root.rb_root;
+	struct ranking_user *u, *next;
+	write_seqcount_begin(&r->seq);
+	list_for_each_entry_safe(u, next, &r->head, ul) {
+		hash_del_rcu(&u->hnode);
+		list_del_rcu(&u->ul);
+	}
+	r->root = RB_ROOT_CACHED;
+	r->count = 0;
+	ranking_changed(r);
+	// The old tree still links every user, and a postorder walk never goes
+	// back to a node already handed to call_rcu()
+	rbtree_postorder_for_each_entry_safe(u, next, &old, node)
+		call_rcu(&u->rcu, free_user_rcu);
+	write_seqcount_end(&r->seq);
+	wake_up_interruptible(&r->wq);
+	run_hist_reset(&r->time_hist);
+	run_hist_reset(&r->vel_hist);
+}
+
+void ranking_flush(struct ranking *r) 
+{
+	mutex_lock(&r->mutex);
+	ranking_flush_locked(r);
+	mutex_unlock(&r->mutex);
+	printk(KERN_DEBUG "Leaderboard has been reset.\n");
+}
+
+/* Replaces the ranking with count entries already in leaderboard order.
+*  Every user is linked as the new right-most node of the tree and the new
+*  tail of the list, so no search is needed and the whole load is linear.
+*/
+int ranking_import(struct ranking *r, const struct ranking_snapshot_entry *e, 
+		   unsigned int count) 
+{
+	struct ranking_user **users;
+	struct rb_node *last = NULL;
+	unsigned int i, skipped = 0;
+	u32 hash;
+
+	// Validate everything before touching the current ranking
+	for (i = 0; i < count; ++i) {
+		if (e[i].name[0] == '\0' || strnlen(e[i].name, RANKING_NAME_LEN) == RANKING_NAME_LEN)
+			return -EINVAL;
+		if (i > 0 && e[i].best_time_us < e[i - 1].best_time_us)
+			return -EINVAL;
+	}
+	users = kvmalloc_array(count, sizeof(*users), GFP_KERNEL);
+	if (!users && count)
+		return -ENOMEM;
+	for (i = 0; i < count; ++i) {
+		users[i] = kmem_cache_alloc(r->cache, GFP_KERNEL);
+		if (!users[i]) {
+			while (i--)
+				kmem_cache_free(r->cache, users[i]);
+			kvfree(users);
+			return -ENOMEM;
+		}
+	}
+
+	mutex_lock(&r->mutex);
+	ranking_flush_locked(r);
+	write_seqcount_begin(&r->seq);
+	for (i = 0; i < count; ++i) {
+		struct ranking_user *u = users[i];
+		struct rb_node *n;
+		u->pool = r->pool;
+		strcpy(u->name, e[i].name);
+		u->best_time = e[i].best_time_us;
+		u->best_vel = e[i].best_vel;
+		history_reset(u);	// snapshots do not carry the history
+		hash = user_hash(u->name);
+		if (find_user(r, u->name, hash)) {
+			// Only the first (best) result of a user is kept
+			kmem_cache_free(r->cache, u);
+			++skipped;
+			continue;
+		}
+		// The new user is below every node of the right spine
+		for (n = r->root.rb_root.rb_node; n; n = n->rb_right)
+			user_entry(n)->subtree_size++;
+		u->subtree_size = 1;
+		rb_link_node_rcu(&u->node, last, last ? &last->rb_right : &r->root.rb_root.rb_node);
+		rb_insert_augmented_cached(&u->node, &r->root, last == NULL, &user_size_cb);
+		last = &u->node;
+		list_add_tail_rcu(&u->ul, &r->head);
+		hash_add_rcu(r->table, &u->hnode, hash);
+	}
+	r->count = count - skipped;
+	ranking_changed(r);
+	write_seqcount_end(&r->seq);
+	wake_up_interruptible(&r->wq);
+	mutex_unlock(&r->mutex);
+
+	kvfree(users);
+	if (skipped)
+		printk(KERN_WARNING "Snapshot had %u duplicate users, kept their best result\n", skipped);
+	printk(KERN_DEBUG "Leaderboard restored with %u users.\n", count - skipped);
+	return 0;
+}
+
+/* Dumps the ranking as a snapshot (header and entries) in a vmalloc()ed
+*  buffer, or returns NULL if out of memory
+*/
+void *ranking_export(struct ranking *r, size_t *size) 
+{
+	struct ranking_snapshot_header *hdr;
+	struct ranking_snapshot_entry *e;
+	struct ranking_user *u;
+
+	// Writers are held off so that count and entries stay consistent
+	mutex_lock(&r->mutex);
+	*size = sizeof(*hdr) + (size_t)r->count * sizeof(*e);
+	hdr = vzalloc(*size);
+	if (!hdr) {
+		mutex_unlock(&r->mutex);
+		return NULL;
+	}
+	hdr->magic = RANKING_SNAPSHOT_MAGIC;
+	hdr->version = RANKING_SNAPSHOT_VERSION;
+	hdr->entry_size = sizeof(*e);
+	hdr->count = r->count;
+	e = (struct ranking_snapshot_entry *)(hdr + 1);
+	list_for_each_entry(u, &r->head, ul) {
+		strcpy(e->name, u->name);
+		e->best_time_us = u->best_time;
+		e->best_vel = u->best_vel;
+		++e;
+	}
+	mutex_unlock(&r->mutex);
+	return hdr;
+}
+
+/* Order statistics, for readers under rcu_read_lock() inside a seq read
+*  section: a concurrent writer may make them wrong, never loop, and the
+*  caller retries.
+*/
+static unsigned int count_faster(struct ranking *r, unsigned int time) 
+{
+	struct rb_node *n = READ_ONCE(r->root.rb_root.rb_node);
+	unsigned int cnt = 0;
+	while (n) {
+		if (user_entry(n)->best_time < time) {
+			cnt += subtree_size(READ_ONCE(n->rb_left)) + 1;
+			n = READ_ONCE(n->rb_right);
+		} else {
+			n = READ_ONCE(n->rb_left);
+		}
+	}
+	return cnt;
+}
+
+static struct ranking_user *select_user(struct ranking *r, unsigned int index) 
+{
+	struct rb_node *n = READ_ONCE(r->root.rb_root.rb_node);
+	unsigned int left;
+	while (n) {
+		left = subtree_size(READ_ONCE(n->rb_left));
+		if (index < left) {
+			n = READ_ONCE(n->rb_left);
+		} else if (index == left) {
+			return user_entry(n);
+		} else {
+			index -= left + 1;
+			n = READ_ONCE(n->rb_right);
+		}
+	}
+	return NULL;
+}
+
+/* Looks up a user by name under rcu_read_lock() */
+static struct ranking_user *find_user_rcu(struct ranking *r, const char *name) 
+{
+	struct ranking_user *u;
+	hash_for_each_possible_rcu(r->table, u, hnode, user_hash(name)) {
+		if (!strcmp(name, u->name))
+			return u;
+	}
+	return NULL;
+}
+
+static void fill_entry(struct ranking_entry *e, struct ranking_user *u, unsigned int pos) 
+{
+	memset(e, 0, sizeof(*e));
+	strscpy(e->name, u->name, sizeof(e->name));
+	e->pos = pos;
+	e->best_time_us = u->best_time;
+	e->best_vel = u->best_vel;
+}
+
+/* Fills up to count entries starting from the offset-th user in O(log n),
+*  returns how many were filled
+*/
+unsigned int ranking_get_page(struct ranking *r, struct ranking_entry *entries, 
+			      unsigned int offset, unsigned int count, unsigned int *total) 
+{
+	struct ranking_user *u;
+	unsigned int seq, filled, pos, prev_time;
+
+	do {
+		seq = read_seqcount_begin(&r->seq);
+		rcu_read_lock();
+		filled = 0;
+		*total = r->count;
+		u = select_user(r, offset);
+		if (u) {
+			pos = count_faster(r, u->best_time) + 1;
+			prev_time = u->best_time;
+			// rb_next() follows parent links, which rotations rewrite
+			// under RCU readers: the list is safe to walk
+			for (; u && filled < count; 
+			     u = list_next_or_null_rcu(&r->head, &u->ul, struct ranking_user, ul)) {
+				if (u->best_time != prev_time)
+					pos = offset + filled + 1;
+				prev_time = u->best_time;
+				fill_entry(&entries[filled++], u, pos);
+			}
+		}
+		rcu_read_unlock();
+	} while (read_seqcount_retry(&r->seq, seq));
+	return filled;
+}
+EXPORT_SYMBOL_GPL(ranking_get_page);
+
+/* Fills the entry of a user with their position, returns false if unknown */
+bool ranking_get_user(struct ranking *r, const char *name, struct ranking_entry *e, 
+		      unsigned int *total) 
+{
+	struct ranking_user *u;
+	unsigned int seq;
+	bool found;
+
+	do {
+		seq = read_seqcount_begin(&r->seq);
+		rcu_read_lock();
+		*total = r->count;
+		u = find_user_rcu(r, name);
+		found = u != NULL;
+		if (found)
+			fill_entry(e, u, count_faster(r, u->best_time) + 1);
+		rcu_read_unlock();
+	} while (read_seqcount_retry(&r->seq, seq));
+	return found;
+}
+EXPORT_SYMBOL_GPL(ranking_get_user);
+
+/* Copies up to *count last runs of a user, oldest first, returns false if
+*  unknown
+*/
+bool ranking_get_history(struct ranking *r, const char *name, struct ranking_run *runs, 
+			 unsigned int *count, unsigned int *total) 
+{
+	unsigned int room = min(*count, r->history_len);
+	struct ranking_user *u;
+	unsigned int seq, i, first;
+	bool found;
+
+	do {
+		seq = read_seqcount_begin(&r->seq);
+		rcu_read_lock();
+		*count = *total = 0;
+		u = find_user_rcu(r, name);
+		found = u != NULL;
+		if (found) {
+			*total = u->runs;
+			*count = min(room, u->history_count);
+			first = u->history_head + r->history_len - *count;
+			for (i = 0; i < *count; ++i)
+				runs[i] = u->history[(first + i) % r->history_len];
+		}
+		rcu_read_unlock();
+	} while (read_seqcount_retry(&r->seq, seq));
+	return found;
+}
+
+/* suffix tells apart the slab caches of the rankings of several traps,
+*  trap their tracepoints
+*/
+struct ranking *ranking_create(const char *suffix, unsigned int trap, 
+			       unsigned int reserve, unsigned int history_len) 
+{
+	struct ranking *r;
+
+	r = kvzalloc(sizeof(*r), GFP_KERNEL);	// mostly the hashtable
+	if (!r)
+		return NULL;
+	INIT_LIST_HEAD(&r->head);
+	r->root = RB_ROOT_CACHED;
+	mutex_init(&r->mutex);
+	seqcount_mutex_init(&r->seq, &r->mutex);
+	init_waitqueue_head(&r->wq);
+	hash_init(r->table);
+	r->trap = trap;
+	r->history_len = min(history_len, (unsigned int)RANKING_HISTORY_MAX);
+
+	// Users come from their own cache, with a reserve for memory pressure
+	snprintf(r->cache_name, sizeof(r->cache_name), "speed_ranking_user%s", suffix);
+	r->cache = kmem_cache_create(r->cache_name, 
+				     struct_size((struct ranking_user *)NULL, history, r->history_len), 
+				     0, 0, NULL);
+	if (!r->cache)
+		goto err_free;
+	r->pool = mempool_create_slab_pool(reserve, r->cache);
+	if (!r->pool)
+		goto err_cache;
+	return r;
+
+err_cache:
+	kmem_cache_destroy(r->cache);
+err_free:
+	kvfree(r);
+	return NULL;
+}
+EXPORT_SYMBOL_GPL(ranking_create);
+
+void ranking_destroy(struct ranking *r) 
+{
+	ranking_flush(r);
+	// Wait for the users still in a grace period to go back to the pool
+	rcu_barrier();
+	mempool_destroy(r->pool);
+	kmem_cache_destroy(r->cache);
+	kvfree(r);
+}
+EXPORT_SYMBOL_GPL(ranking_destroy);
@@ -0,0 +1,113 @@
+#ifndef RANKING_H
+#define RANKING_H
+
+#include <linux/hashtable.h>
+#include <linux/list.h>
+#include <linux/mempool.h>
+#include <linux/mutex.h>
+#include <linux/rbtree.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+#include "run_stats.h"
+#include "speed_uapi.h"
+
+#define RANKING_HASH_BITS	14	// 16k buckets, short chains for big events
+
+/* A ranking is read locklessly under RCU, following head in leaderboard
+*  order. mutex only serializes the writers, which use the rbtree to find
+*  where to link a user and the hashtable to find users.
+*  Users are never moved in place: a new personal best links an updated copy
+*  and the old entry is freed after a grace period.
+*  The tree is augmented with subtree sizes to answer rank queries; those
+*  readers descend it under RCU too and retry if seq moved.
+*  Rankings are independent from the devices showing them, so several can
+*  live side by side.
+*/
+struct ranking {
+	struct list_head head;
+	struct rb_root_cached root;
+	struct mutex mutex;
+	seqcount_mutex_t seq;
+	unsigned long gen;		// bumped on every change of the order
+	wait_queue_head_t wq;		// waiters for a change of the order
+	unsigned int count;		// number of users
+	unsigned int trap;		// owner, for the tracepoints
+	unsigned int history_len;	// runs kept per user
+	struct run_hist time_hist, vel_hist;	// all runs, under mutex
+	char cache_name[32];		// "speed_ranking_user", then "..._N"
+	struct kmem_cache *cache;
+	mempool_t *pool;
+	DECLARE_HASHTABLE(table, RANKING_HASH_BITS);
+};
+
+struct ranking_user {
+	char name[RANKING_NAME_LEN];
+	unsigned int best_time;		// microseconds
+	unsigned int best_vel;		// millimeters / second
+	unsigned int subtree_size;	// users in the subtree rooted here
+	struct rb_node node;
+	struct hlist_node hnode;
+	struct list_head ul;
+	struct rcu_head rcu;
+	mempool_t *pool;		// where to go back after the grace period
+	/* Last runs, a ring of history_len slots. Unlike the best result they
+	*  are updated in place, inside a seq write section.
+	*/
+	unsigned int runs;		// runs ever stored
+	unsigned int history_head;	// slot of the next run
+	unsigned int history_count;	// slots in use
+	struct ranking_run history[];
+};
+
+/* Cursor over a ranking in leaderboard order.
+*  pos is the 1-based index of the current user, rank the position shown for
+*  it: users with the same time as the previous one are ex-aequo and share it.
+*/
+struct ranking_iter {
+	struct ranking *ranking;
+	struct ranking_user *node;
+	loff_t pos;
+	unsigned int rank;
+	unsigned long gen;
+};
+
+struct ranking *ranking_create(const char *suffix, unsigned int trap,
+			       unsigned int reserve, unsigned int history_len);
+void ranking_destroy(struct ranking *r);
+
+int ranking_store_time(struct ranking *r, const char *name, unsigned int time_us,
+		       unsigned int vel_mm_s, const u32 *splits_us, unsigned int nsplits);
+void ranking_flush(struct ranking *r);
+int ranking_import(struct ranking *r, const struct ranking_snapshot_entry *e,
+		   unsigned int count);
+void *ranking_export(struct ranking *r, size_t *size);
+
+void ranking_iter_init(struct ranking_iter *it, struct ranking *r);
+void ranking_iter_first(struct ranking_iter *it);
+void ranking_iter_next(struct ranking_iter *it);
+struct ranking_user *ranking_iter_seek(struct ranking_iter *it, loff_t pos);
+
+int ranking_print_header(char *buf, size_t size);
+int ranking_print_user(char *buf, size_t size, unsigned int rank,
+		       const struct ranking_user *u);
+int ranking_print(struct ranking *r, char *buf, size_t size);
+int ranking_print_leader(struct ranking *r, char *buf, size_t size);
+int ranking_print_stats(struct ranking *r, char *buf, size_t size);
+void ranking_debug_print(struct ranking *r);
+
+unsigned int ranking_get_page(struct ranking *r, struct ranking_entry *entries,
+			      unsigned int offset, unsigned int count, unsigned int *total);
+bool ranking_get_user(struct ranking *r, const char *name, struct ranking_entry *e,
+		      unsigned int *total);
+bool ranking_get_history(struct ranking *r, const char *name, struct ranking_run *runs,
+			 unsigned int *count, unsigned int *total);
+
+static inline unsigned long ranking_generation(struct ranking *r)
+{
+	return READ_ONCE(r->gen);
+}
+
+#endif /* RANKING_H */
@@ -0,0 +1,312 @@
+#include <kunit/test.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/module.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+
+#include "ranking.h"
+
+MODULE_DESCRIPTION("KUnit tests of the speed trap ranking");
+MODULE_LICENSE("GPL");
+
+#define TEST_RESERVE	16
+#define TEST_HISTORY	1	// keeps the 100k users of the timed cases small
+
+struct expected_user {
+	const char *name;
+	unsigned int time;
+	unsigned int pos;
+};
+
+static int ranking_test_init(struct kunit *test) 
+{
+	struct ranking *r = ranking_create("_test", 0, TEST_RESERVE, TEST_HISTORY);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, r);
+	test->priv = r;
+	return 0;
+}
+
+static void ranking_test_exit(struct kunit *test) 
+{
+	ranking_destroy(test->priv);
+}
+
+static void store(struct kunit *test, const char *name, unsigned int time) 
+{
+	KUNIT_ASSERT_EQ(test, 0, ranking_store_time(test->priv, name, time, 
+						    100000000 / time, NULL, 0));
+}
+
+/* Checks the leaderboard both through the ioctl page query and the cursor of
+*  /dev/ranking, which number ex-aequo users on their own
+*/
+static void expect_ranking(struct kunit *test, const struct expected_user *exp, 
+			   unsigned int count) 
+{
+	struct ranking *r = test->priv;
+	struct ranking_entry e[8];
+	struct ranking_iter it;
+	unsigned int total, i;
+
+	KUNIT_ASSERT_LE(test, count, (unsigned int)ARRAY_SIZE(e));
+	KUNIT_EXPECT_EQ(test, count, ranking_get_page(r, e, 0, ARRAY_SIZE(e), &total));
+	KUNIT_EXPECT_EQ(test, count, total);
+	for (i = 0; i < count; ++i) {
+		// KUnit copies its operands, so names go as pointers
+		KUNIT_EXPECT_STREQ(test, exp[i].name, (const char *)e[i].name);
+		KUNIT_EXPECT_EQ(test, exp[i].time, e[i].best_time_us);
+		KUNIT_EXPECT_EQ(test, exp[i].pos, e[i].pos);
+	}
+
+	rcu_read_lock();
+	ranking_iter_init(&it, r);
+	ranking_iter_first(&it);
+	for (i = 0; i < count && it.node; ++i, ranking_iter_next(&it)) {
+		KUNIT_EXPECT_STREQ(test, exp[i].name, (const char *)it.node->name);
+		KUNIT_EXPECT_EQ(test, exp[i].time, it.node->best_time);
+		KUNIT_EXPECT_EQ(test, exp[i].pos, it.rank);
+	}
+	KUNIT_EXPECT_EQ(test, count, i);
+	KUNIT_EXPECT_TRUE(test, !it.node);
+	rcu_read_unlock();
+}
+
+static void ranking_test_empty(struct kunit *test) 
+{
+	struct ranking *r = test->priv;
+	struct ranking_entry e[4];
+	struct ranking_iter it;
+	unsigned int total = 1;
+
+	KUNIT_EXPECT_EQ(test, 0U, ranking_get_page(r, e, 0, ARRAY_SIZE(e), &total));
+	KUNIT_EXPECT_EQ(test, 0U, total);
+	rcu_read_lock();
+	ranking_iter_init(&it, r);
+	ranking_iter_first(&it);
+	KUNIT_EXPECT_TRUE(test, !it.node);
+	KUNIT_EXPECT_TRUE(test, !ranking_iter_seek(&it, 1));
+	rcu_read_unlock();
+
+	// The first user goes in an empty tree and list
+	store(test, "first", 5000000);
+	expect_ranking(test, (const struct expected_user[]) {
+		{ "first", 5000000, 1 },
+	}, 1);
+}
+
+static void ranking_test_head_insert(struct kunit *test) 
+{
+	store(test, "b", 200);
+	store(test, "c", 300);
+	store(test, "a", 100);		// before every user
+	store(test, "d", 400);		// after every user
+	expect_ranking(test, (const struct expected_user[]) {
+		{ "a", 100, 1 },
+		{ "b", 200, 2 },
+		{ "c", 300, 3 },
+		{ "d", 400, 4 },
+	}, 4);
+}
+
+static void ranking_test_exaequo(struct kunit *test) 
+{
+	struct ranking_entry e[2];
+	unsigned int total;
+
+	store(test, "a", 100);
+	store(test, "b", 200);
+	store(test, "c", 200);
+	store(test, "d", 200);
+	store(test, "e", 300);
+	store(test, "f", 300);
+	expect_ranking(test, (const struct expected_user[]) {
+		{ "a", 100, 1 },
+		{ "b", 200, 2 },
+		{ "c", 200, 2 },
+		{ "d", 200, 2 },
+		{ "e", 300, 5 },
+		{ "f", 300, 5 },
+	}, 6);
+
+	// A page starting inside a tie still numbers it from its first user
+	KUNIT_ASSERT_EQ(test, 2U, ranking_get_page(test->priv, e, 2, ARRAY_SIZE(e), &total));
+	KUNIT_EXPECT_STREQ(test, "c", (const char *)e[0].name);
+	KUNIT_EXPECT_EQ(test, 2U, e[0].pos);
+	KUNIT_EXPECT_EQ(test, 2U, e[1].pos);
+}
+
+static void ranking_test_reposition(struct kunit *test) 
+{
+	struct ranking_entry e;
+	unsigned int total;
+
+	store(test, "a", 300);
+	store(test, "b", 200);
+	store(test, "c", 100);
+	store(test, "a", 50);		// personal best: from last to first
+	store(test, "b", 250);		// slower: kept where it was
+	store(test, "c", 100);		// same time: not a personal best
+	expect_ranking(test, (const struct expected_user[]) {
+		{ "a", 50, 1 },
+		{ "c", 100, 2 },
+		{ "b", 200, 3 },
+	}, 3);
+
+	// Tied with the user it moves next to
+	store(test, "b", 100);
+	expect_ranking(test, (const struct expected_user[]) {
+		{ "a", 50, 1 },
+		{ "c", 100, 2 },
+		{ "b", 100, 2 },
+	}, 3);
+	KUNIT_ASSERT_TRUE(test, ranking_get_user(test->priv, "b", &e, &total));
+	KUNIT_EXPECT_EQ(test, 2U, e.pos);
+	KUNIT_EXPECT_EQ(test, 3U, total);
+}
+
+static void ranking_test_iter_seek(struct kunit *test) 
+{
+	struct ranking *r = test->priv;
+	struct ranking_iter it;
+	struct ranking_user *u;
+
+	store(test, "a", 100);
+	store(test, "b", 200);
+	store(test, "c", 300);
+
+	rcu_read_lock();
+	ranking_iter_init(&it, r);
+	u = ranking_iter_seek(&it, 3);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, u);
+	KUNIT_EXPECT_STREQ(test, "c", (const char *)u->name);
+	u = ranking_iter_seek(&it, 2);		// backwards
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, u);
+	KUNIT_EXPECT_STREQ(test, "b", (const char *)u->name);
+	KUNIT_EXPECT_TRUE(test, !ranking_iter_seek(&it, 4));
+	rcu_read_unlock();
+
+	// A change of the order drops the cached position
+	store(test, "c", 50);
+	rcu_read_lock();
+	u = ranking_iter_seek(&it, 1);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, u);
+	KUNIT_EXPECT_STREQ(test, "c", (const char *)u->name);
+	rcu_read_unlock();
+}
+
+static void ranking_test_iter_moved(struct kunit *test) 
+{
+	struct ranking *r = test->priv;
+	struct ranking_iter it;
+	struct ranking_user *u;
+	unsigned long gen;
+
+	store(test, "a", 100);
+	store(test, "b", 200);
+	store(test, "c", 300);
+
+	rcu_read_lock();
+	ranking_iter_init(&it, r);
+	u = ranking_iter_seek(&it, 2);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, u);
+	KUNIT_EXPECT_STREQ(test, "b", (const char *)u->name);
+	rcu_read_unlock();
+	gen = it.gen;
+
+	// The cached user is replaced by a new entry and freed after a grace period
+	store(test, "b", 50);
+	KUNIT_EXPECT_NE(test, gen, ranking_generation(r));
+	rcu_read_lock();
+	u = ranking_iter_seek(&it, 2);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, u);
+	KUNIT_EXPECT_STREQ(test, "a", (const char *)u->name);
+	// Only a restart from the head takes the new gen
+	KUNIT_EXPECT_EQ(test, ranking_generation(r), it.gen);
+	rcu_read_unlock();
+}
+
+/* Timed cases: n users enter the ranking, then each one improves, then the
+*  whole board is formatted as /dev/ranking does. Times are spread with a
+*  multiplicative hash, with some ties.
+*/
+static unsigned int bench_time(unsigned int i) 
+{
+	return 4000000 + (i * 2654435761U) % 4000000;
+}
+
+static void ranking_test_bench(struct kunit *test, unsigned int n) 
+{
+	struct ranking *r = test->priv;
+	char name[RANKING_NAME_LEN], line[128];
+	struct ranking_entry e[64];
+	struct ranking_iter it;
+	unsigned int i, total, prev_time = 0;
+	u64 start, insert_ns, update_ns, format_ns;
+	size_t bytes = 0;
+
+	start = ktime_get_ns();
+	for (i = 0; i < n; ++i) {
+		snprintf(name, sizeof(name), "rider%u", i);
+		store(test, name, bench_time(i));
+	}
+	insert_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	for (i = 0; i < n; ++i) {
+		snprintf(name, sizeof(name), "rider%u", i);
+		store(test, name, bench_time(i) - 1000 - i % 1000);
+	}
+	update_ns = ktime_get_ns() - start;
+
+	start = ktime_get_ns();
+	rcu_read_lock();
+	ranking_iter_init(&it, r);
+	for (ranking_iter_first(&it); it.node; ranking_iter_next(&it))
+		bytes += ranking_print_user(line, sizeof(line), it.rank, it.node);
+	rcu_read_unlock();
+	format_ns = ktime_get_ns() - start;
+
+	kunit_info(test, "%u users: insert %llu ns/op, update %llu ns/op, format %llu ns/op (%zu bytes)\n", 
+		   n, div_u64(insert_ns, n), div_u64(update_ns, n), div_u64(format_ns, n), bytes);
+
+	// Every user is in, still in order
+	KUNIT_ASSERT_EQ(test, (unsigned int)ARRAY_SIZE(e), 
+			ranking_get_page(r, e, n / 2, ARRAY_SIZE(e), &total));
+	KUNIT_EXPECT_EQ(test, n, total);
+	for (i = 0; i < ARRAY_SIZE(e); ++i) {
+		KUNIT_EXPECT_GE(test, e[i].best_time_us, prev_time);
+		prev_time = e[i].best_time_us;
+	}
+}
+
+static void ranking_test_bench_10k(struct kunit *test) 
+{
+	ranking_test_bench(test, 10000);
+}
+
+static void ranking_test_bench_100k(struct kunit *test) 
+{
+	ranking_test_bench(test, 100000);
+}
+
+static struct kunit_case ranking_test_cases[] = {
+	KUNIT_CASE(ranking_test_empty),
+	KUNIT_CASE(ranking_test_head_insert),
+	KUNIT_CASE(ranking_test_exaequo),
+	KUNIT_CASE(ranking_test_reposition),
+	KUNIT_CASE(ranking_test_iter_seek),
+	KUNIT_CASE(ranking_test_iter_moved),
+	KUNIT_CASE(ranking_test_bench_10k),
+	KUNIT_CASE(ranking_test_bench_100k),
+	{}
+};
+
+static struct kunit_suite ranking_test_suite = {
+	.name = "speed_ranking",
+	.init = ranking_test_init,
+	.exit = ranking_test_exit,
+	.test_cases = ranking_test_cases,
+};
+
+kunit_test_suites(&ranking_test_suite);
@@ -0,0 +1,65 @@
+#include <linux/bitops.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#include "run_stats.h"
+
+static unsigned int bucket_of(u32 value) 
+{
+	unsigned int msb;
+
+	if (value < 2 * RUN_HIST_SUB_BUCKETS)
+		return value;
+	msb = fls(value) - 1;
+	return (msb - RUN_HIST_SUB_BITS + 1) * RUN_HIST_SUB_BUCKETS + 
+	       ((value >> (msb - RUN_HIST_SUB_BITS)) & (RUN_HIST_SUB_BUCKETS - 1));
+}
+
+/* Middle of the values counted in a bucket */
+static u32 bucket_value(unsigned int bucket) 
+{
+	unsigned int shift;
+	u32 low;
+
+	if (bucket < 2 * RUN_HIST_SUB_BUCKETS)
+		return bucket;
+	shift = bucket / RUN_HIST_SUB_BUCKETS - 1;
+	low = (RUN_HIST_SUB_BUCKETS + bucket % RUN_HIST_SUB_BUCKETS) << shift;
+	return low + ((1U << shift) - 1) / 2;
+}
+
+void run_hist_reset(struct run_hist *h) 
+{
+	memset(h->counts, 0, sizeof(h->counts));
+}
+
+/* The histograms are not locked: callers serialize updates and reads */
+void run_hist_add(struct run_hist *h, u32 value) 
+{
+	++h->counts[bucket_of(value)];
+}
+
+/* Computes the n given percentiles (ascending) in O(buckets), whatever the
+*  number of values, returns the number of values counted
+*/
+u64 run_hist_quantiles(const struct run_hist *h, const unsigned int *percents, 
+		       u32 *values, unsigned int n) 
+{
+	u64 total = 0, seen = 0, rank;
+	unsigned int b, i = 0;
+
+	for (b = 0; b < RUN_HIST_BUCKETS; ++b)
+		total += h->counts[b];
+	for (b = 0; b < RUN_HIST_BUCKETS && i < n; ++b) {
+		seen += h->counts[b];
+		while (i < n) {
+			rank = max_t(u64, DIV_ROUND_UP_ULL(total * percents[i], 100), 1);
+			if (seen < rank)
+				break;
+			values[i++] = bucket_value(b);
+		}
+	}
+	while (i < n)
+		values[i++] = 0;	// empty histogram
+	return total;
+}
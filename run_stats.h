@@ -0,0 +1,23 @@
+#ifndef RUN_STATS_H
+#define RUN_STATS_H
+
+#include <linux/types.h>
+
+/* Log-linear (HDR-style) histogram of u32 values: values below
+*  2 * RUN_HIST_SUB_BUCKETS have a bucket each, every larger power of two is
+*  split in RUN_HIST_SUB_BUCKETS buckets, so any value is known within 1/16.
+*/
+#define RUN_HIST_SUB_BITS	4
+#define RUN_HIST_SUB_BUCKETS	(1U << RUN_HIST_SUB_BITS)
+#define RUN_HIST_BUCKETS	((32 - RUN_HIST_SUB_BITS + 1) * RUN_HIST_SUB_BUCKETS)
+
+struct run_hist {
+	u32 counts[RUN_HIST_BUCKETS];
+};
+
+void run_hist_reset(struct run_hist *h);
+void run_hist_add(struct run_hist *h, u32 value);
+u64 run_hist_quantiles(const struct run_hist *h, const unsigned int *percents, 
+		       u32 *values, unsigned int n);
+
+#endif /* RUN_STATS_H */
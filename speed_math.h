@@ -0,0 +1,41 @@
+#ifndef SPEED_MATH_H
+#define SPEED_MATH_H
+
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/math64.h>
+#include <linux/types.h>
+
+/* Run time and speed from the PIR timestamps, shared by the module and the
+*  userspace benchmark
+*/
+static inline u64 speed_run_time_us(u64 t1, u64 t2) 
+{
+	return div_u64(t2 - t1, NSEC_PER_USEC);
+}
+
+/* Only times that fit the ranking are kept */
+static inline bool speed_run_time_valid(u64 time_us) 
+{
+	return time_us != 0 && time_us <= UINT_MAX;
+}
+
+/* Millimeters / second over dist decimeters, saturated to fit the ranking */
+static inline unsigned int speed_velocity(unsigned int dist, u64 time_us) 
+{
+	// decimeters to millimeters, microseconds to seconds
+	return min_t(u64, div64_u64((u64)dist * 100 * USEC_PER_SEC, time_us), UINT_MAX);
+}
+
+/* Time of each segment between two consecutive sensors, from count
+*  timestamps. The splits fit when the whole run time does.
+*/
+static inline unsigned int speed_splits_us(const u64 *ts, unsigned int count, u32 *splits) 
+{
+	unsigned int i;
+	for (i = 1; i < count; ++i)
+		splits[i - 1] = speed_run_time_us(ts[i - 1], ts[i]);
+	return count - 1;
+}
+
+#endif /* SPEED_MATH_H */
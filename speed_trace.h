@@ -0,0 +1,145 @@
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM speed
+
+#if !defined(SPEED_TRACE_H) || defined(TRACE_HEADER_MULTI_READ)
+#define SPEED_TRACE_H
+
+#include <linux/tracepoint.h>
+
+#ifndef SPEED_TRACE_ENUMS
+#define SPEED_TRACE_ENUMS
+/* Why a PIR edge was dropped before reaching the run state */
+enum pir_reject_reason {
+	PIR_REJECT_DEAD_TIME,
+	PIR_REJECT_SHORT_PULSE,
+};
+#endif
+
+/* Tracepoints along a run, from the PIR edges to the display:
+*  echo 1 > /sys/kernel/tracing/events/speed/enable
+*  Each event has the number of its trap, 0 for the first one.
+*/
+
+TRACE_EVENT(speed_pir_edge,
+	TP_PROTO(unsigned int trap, unsigned int sensor, u64 timestamp),
+	TP_ARGS(trap, sensor, timestamp),
+	TP_STRUCT__entry(
+		__field(unsigned int, trap)
+		__field(unsigned int, sensor)
+		__field(u64, timestamp)
+	),
+	TP_fast_assign(
+		__entry->trap = trap;
+		__entry->sensor = sensor;
+		__entry->timestamp = timestamp;
+	),
+	TP_printk("trap=%u pir%u ts=%llu", __entry->trap, __entry->sensor, __entry->timestamp)
+);
+
+TRACE_EVENT(speed_pir_reject,
+	TP_PROTO(unsigned int trap, unsigned int sensor, u64 timestamp, unsigned int reason),
+	TP_ARGS(trap, sensor, timestamp, reason),
+	TP_STRUCT__entry(
+		__field(unsigned int, trap)
+		__field(unsigned int, sensor)
+		__field(u64, timestamp)
+		__field(unsigned int, reason)
+	),
+	TP_fast_assign(
+		__entry->trap = trap;
+		__entry->sensor = sensor;
+		__entry->timestamp = timestamp;
+		__entry->reason = reason;
+	),
+	TP_printk("trap=%u pir%u ts=%llu %s", __entry->trap, __entry->sensor, __entry->timestamp, 
+		  __print_symbolic(__entry->reason, 
+				   { PIR_REJECT_DEAD_TIME, "dead time" }, 
+				   { PIR_REJECT_SHORT_PULSE, "short pulse" }))
+);
+
+TRACE_EVENT(speed_sample,
+	TP_PROTO(unsigned int trap, const char *name, u64 t1, u64 t2),
+	TP_ARGS(trap, name, t1, t2),
+	TP_STRUCT__entry(
+		__field(unsigned int, trap)
+		__string(name, name)
+		__field(u64, t1)
+		__field(u64, t2)
+	),
+	TP_fast_assign(
+		__entry->trap = trap;
+		__assign_str(name, name);
+		__entry->t1 = t1;
+		__entry->t2 = t2;
+	),
+	TP_printk("trap=%u rider=%s t1=%llu t2=%llu delta_ns=%llu", __entry->trap, 
+		  __get_str(name), __entry->t1, __entry->t2, __entry->t2 - __entry->t1)
+);
+
+TRACE_EVENT(speed_ranking_update,
+	TP_PROTO(unsigned int trap, const char *name, unsigned int time_us, 
+		 unsigned int vel, bool found, bool improved),
+	TP_ARGS(trap, name, time_us, vel, found, improved),
+	TP_STRUCT__entry(
+		__field(unsigned int, trap)
+		__string(name, name)
+		__field(unsigned int, time_us)
+		__field(unsigned int, vel)
+		__field(bool, found)
+		__field(bool, improved)
+	),
+	TP_fast_assign(
+		__entry->trap = trap;
+		__assign_str(name, name);
+		__entry->time_us = time_us;
+		__entry->vel = vel;
+		__entry->found = found;
+		__entry->improved = improved;
+	),
+	TP_printk("trap=%u user=%s time_us=%u vel_mm_s=%u %s", __entry->trap, 
+		  __get_str(name), __entry->time_us, __entry->vel, 
+		  !__entry->found ? "insert" : __entry->improved ? "reposition" : "kept")
+);
+
+TRACE_EVENT(speed_display_start,
+	TP_PROTO(unsigned int trap, unsigned int value, unsigned int dot_pos, 
+		 unsigned int msecs),
+	TP_ARGS(trap, value, dot_pos, msecs),
+	TP_STRUCT__entry(
+		__field(unsigned int, trap)
+		__field(unsigned int, value)
+		__field(unsigned int, dot_pos)
+		__field(unsigned int, msecs)
+	),
+	TP_fast_assign(
+		__entry->trap = trap;
+		__entry->value = value;
+		__entry->dot_pos = dot_pos;
+		__entry->msecs = msecs;
+	),
+	TP_printk("trap=%u value=%u dot_pos=%u msecs=%u", __entry->trap, 
+		  __entry->value, __entry->dot_pos, __entry->msecs)
+);
+
+TRACE_EVENT(speed_display_stop,
+	TP_PROTO(unsigned int trap, unsigned int value),
+	TP_ARGS(trap, value),
+	TP_STRUCT__entry(
+		__field(unsigned int, trap)
+		__field(unsigned int, value)
+	),
+	TP_fast_assign(
+		__entry->trap = trap;
+		__entry->value = value;
+	),
+	TP_printk("trap=%u value=%u", __entry->trap, __entry->value)
+);
+
+#endif /* SPEED_TRACE_H */
+
+/* This part must be outside the header guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE speed_trace
+#include <trace/define_trace.h>
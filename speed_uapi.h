@@ -0,0 +1,146 @@
+#ifndef SPEED_UAPI_H
+#define SPEED_UAPI_H
+
+/* Layouts shared with userspace: this header has no kernel dependencies and
+*  can be included as is by programs talking to the speed devices.
+*/
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+/* PIR sensors, numbered from 1 in track order. A run is timed from the
+*  first one to the last one, with a split time for each segment between two
+*  consecutive sensors.
+*/
+#define PIR_MAX_SENSORS		8
+#define RANKING_SPLITS_MAX	(PIR_MAX_SENSORS - 1)
+
+/* PIR edge events
+*  Any /dev/pirN can be mmap()ed read-only: the mapping starts with
+*  a struct pir_ring_header, followed (at data_offset) by size struct pir_event
+*  slots. Event n is stored in slot n % size.
+*  head is the number of events ever recorded. A slot is stable when its seq
+*  reads the same non-zero value before and after copying it; seq is n + 1 for
+*  event n, so a larger value means the event was overwritten by a newer one.
+*  Every edge is recorded, including the ones the filter drops: those are
+*  flagged PIR_EVENT_REJECTED. An edge waiting for its pulse check is only
+*  recorded once the check is over.
+*/
+#define PIR_RING_VERSION	1
+#define PIR_RING_SIZE		4096	// events, power of two
+
+#define PIR_EVENT_ACCEPTED	0x1	// edge used as a timestamp of a run
+#define PIR_EVENT_LOST		0x2	// trace records only, see below
+#define PIR_EVENT_REJECTED	0x4	// edge dropped by the dead time or pulse filter
+
+struct pir_ring_header {
+	__u32 version;
+	__u32 size;
+	__u32 data_offset;
+	__u32 reserved;
+	__u64 head;
+};
+
+struct pir_event {
+	__u64 seq;
+	__u64 timestamp_ns;	// CLOCK_MONOTONIC
+	__u32 sensor;		// 1 for PIR1, 2 for PIR2...
+	__u32 flags;
+};
+
+/* PIR traces
+*  speed/pir_record in debugfs streams the edges recorded since it was
+*  opened as struct pir_trace_record. With the sim backend, such a trace can
+*  be written back to speed/pir_replay.
+*  A reader too slow to keep up loses the oldest edges. They are replaced by
+*  a single record with PIR_EVENT_LOST, sensor 0 and the number of edges lost
+*  in timestamp_ns; pir_replay skips it, and the rejected edges.
+*/
+struct pir_trace_record {
+	__u64 timestamp_ns;	// CLOCK_MONOTONIC
+	__u32 sensor;
+	__u32 flags;		// PIR_EVENT_*
+};
+
+/* Ranking snapshot
+*  Reading /dev/ranking_snapshot returns the whole leaderboard as a
+*  struct ranking_snapshot_header followed by count entries of entry_size
+*  bytes, in leaderboard order. Writing such a snapshot back (in as many
+*  write() calls as needed) replaces the leaderboard once it is complete.
+*/
+#define RANKING_NAME_LEN		32	// including the terminating NUL
+
+#define RANKING_SNAPSHOT_MAGIC		0x4b4e5253	// "SRNK"
+#define RANKING_SNAPSHOT_VERSION	1
+
+struct ranking_snapshot_header {
+	__u32 magic;
+	__u16 version;
+	__u16 entry_size;
+	__u32 count;
+	__u32 reserved;
+};
+
+struct ranking_snapshot_entry {
+	char name[RANKING_NAME_LEN];
+	__u32 best_time_us;
+	__u32 best_vel;		// millimeters / second
+};
+
+/* Ranking queries, ioctl()s on /dev/ranking
+*  Positions are 1-based and shared by ex-aequo users; offsets are 0-based
+*  indexes in leaderboard order.
+*/
+#define RANKING_IOC_MAGIC	0xb5
+#define RANKING_PAGE_MAX	256	// entries returned by one call at most
+
+struct ranking_entry {
+	char name[RANKING_NAME_LEN];
+	__u32 pos;
+	__u32 best_time_us;
+	__u32 best_vel;		// millimeters / second
+	__u32 reserved;
+};
+
+struct ranking_page {
+	__u32 offset;		// in: first entry (ignored by RANKING_IOC_TOP)
+	__u32 count;		// in: room in entries, out: entries filled
+	__u32 total;		// out: users in the ranking
+	__u32 reserved;
+	__u64 entries;		// in: pointer to an array of struct ranking_entry
+};
+
+struct ranking_user_query {
+	char name[RANKING_NAME_LEN];	// in
+	struct ranking_entry entry;	// out
+	__u32 total;			// out: users in the ranking
+	__u32 reserved;
+};
+
+/* Recent runs of a user, oldest first. Only the last history_len runs are
+*  kept (module parameter, RANKING_HISTORY_MAX at most); total tells how many
+*  runs the user did since entering the ranking.
+*/
+#define RANKING_HISTORY_MAX	64
+
+struct ranking_run {
+	__u64 timestamp_ns;	// CLOCK_REALTIME
+	__u32 time_us;
+	__u32 vel;		// millimeters / second
+	__u32 nsplits;		// segments timed, sensors - 1
+	__u32 splits_us[RANKING_SPLITS_MAX];	// time of each segment
+};
+
+struct ranking_history {
+	char name[RANKING_NAME_LEN];	// in
+	__u32 count;		// in: room in runs, out: runs filled
+	__u32 total;		// out: runs ever stored for the user
+	__u64 runs;		// in: pointer to an array of struct ranking_run
+};
+
+#define RANKING_IOC_TOP		_IOWR(RANKING_IOC_MAGIC, 1, struct ranking_page)
+#define RANKING_IOC_PAGE	_IOWR(RANKING_IOC_MAGIC, 2, struct ranking_page)
+#define RANKING_IOC_USER	_IOWR(RANKING_IOC_MAGIC, 3, struct ranking_user_query)
+#define RANKING_IOC_HISTORY	_IOWR(RANKING_IOC_MAGIC, 4, struct ranking_history)
+
+#endif /* SPEED_UAPI_H */